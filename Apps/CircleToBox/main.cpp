@@ -14,11 +14,21 @@
 #include <thread>
 #include <mutex>
 #include <set>
+#include <unordered_map>
 
 #include "texture/TextureCache.h"
+#include "job/JobSystem.h"
+#include "collision/CircleToBox.h"
+#include "collision/SweepAndPrune.h"
+#include "collision/CircleToBoxBatch.h"
+#include "collision/CollisionWorld.h"
 
 
 bool show_imgui_demo = false;
+bool show_benchmark = false;
+bool continuous_collision = true;
+int solver_iterations = 8;
+bool threaded_contacts = true;
 
 const char* Application_GetName()
 {
@@ -32,6 +42,7 @@ struct Rect : ImVec2
 	float w;
 	float h;
 	bool intersects;
+	CollisionWorld::BodyId body;
 
 	float minx() const
 	{
@@ -66,6 +77,7 @@ struct Circle : ImVec2
 	bool intersects;
 	float radius;
 	ImVec2 prePoint;
+	CollisionWorld::BodyId body;
 };
 
 inline float vec2Length(const ImVec2& pt)
@@ -93,6 +105,25 @@ std::vector<std::shared_ptr<Rect>> rects;
 std::vector<std::shared_ptr<Circle>> circles;
 std::set<std::shared_ptr<Circle>> clickCircles;
 
+// The world moves the shapes, they only draw where it put them. Only
+// rect/circle pairs collide.
+enum : uint32_t { Category_Rect = 1, Category_Circle = 2 };
+CollisionWorld world;
+
+// tests the world's pairs, a thread per core
+JobSystem jobs;
+
+void jobsParallelFor(void* context, size_t count, size_t chunkSize, CollisionWorld::JobFunction function, void* data)
+{
+	static_cast<JobSystem*>(context)->parallelFor(count, chunkSize, function, data);
+}
+
+// Projectiles are fired with the right mouse button, the oldest one is
+// reused once there are MAX_PROJECTILES.
+const size_t MAX_PROJECTILES = 16;
+std::vector<std::shared_ptr<Circle>> projectiles;
+size_t nextProjectile = 0;
+
 void Application_Initialize()
 {
 	{
@@ -115,6 +146,17 @@ void Application_Initialize()
 		rects.push_back(rect);
 	}
 
+	{
+		// thin enough for a projectile to pass through between two frames
+		auto rect = std::make_shared<Rect>();
+		rect->x = -300.0f;
+		rect->y = 0.0f;
+		rect->w = 10.0f;
+		rect->h = 300.0f;
+		rect->intersects = false;
+		rects.push_back(rect);
+	}
+
 	{
 		auto circle = std::make_shared<Circle>();
 		circle->x = 0.0f;
@@ -142,10 +184,46 @@ void Application_Initialize()
 		circle->intersects = false;
 		circles.push_back(circle);
 	}
+
+	// projectiles slow down to a stop in a few seconds
+	world.setDamping(0.99f);
+	for (auto& rect : rects)
+	{
+		rect->body = world.addBox(rect->x, rect->y, rect->w, rect->h, 0.0f, Category_Rect, Category_Circle);
+	}
+	for (auto& circle : circles)
+	{
+		circle->body = world.addCircle(circle->x, circle->y, circle->radius, 1.0f, Category_Circle, Category_Rect);
+	}
+}
+
+void fireProjectile(const ImVec2& position, const ImVec2& velocity)
+{
+	std::shared_ptr<Circle> circle;
+	if (projectiles.size() < MAX_PROJECTILES)
+	{
+		circle = std::make_shared<Circle>();
+		circle->radius = 6.0f;
+		circle->body = world.addCircle(position.x, position.y, circle->radius, 1.0f, Category_Circle, Category_Rect);
+		circles.push_back(circle);
+		projectiles.push_back(circle);
+	}
+	else
+	{
+		circle = projectiles[nextProjectile];
+		nextProjectile = (nextProjectile + 1) % MAX_PROJECTILES;
+	}
+	circle->x = position.x;
+	circle->y = position.y;
+	circle->intersects = false;
+	world.setPosition(circle->body, position.x, position.y);
+	world.setVelocity(circle->body, velocity.x, velocity.y);
 }
 
 void Application_Finalize()
 {
+	world.clear();
+	projectiles.clear();
 	TextureCache::getInstance()->releaseAll();
 	TextureCache::destroy();
 }
@@ -156,31 +234,6 @@ void Application_Finalize()
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
-bool CircleToBox(float cx, float cy, float radius, float bx, float by, float bw, float bh)
-{
-	const auto halfw = bw * 0.5f;
-	const auto halfh = bh * 0.5f;
-
-	float dx = std::abs(cx - bx);
-	if (dx > halfw + radius)
-		return false;
-
-	float dy = std::abs(cy - by);
-	if (dy > halfh + radius)
-		return false;
-
-	if (dx <= halfw || dy <= halfh)
-		return true;
-
-	const float xCornerDist = dx - halfw;
-	const float yCornerDist = dy - halfh;
-	const float xCornerDistSq = xCornerDist * xCornerDist;
-	const float yCornerDistSq = yCornerDist * yCornerDist;
-	const float maxCornerDistSq = radius * radius;
-	return xCornerDistSq + yCornerDistSq <= maxCornerDistSq;
-}
-
-
 #if 0
 
 #define OFFSET_VALUE 1.0f
@@ -358,104 +411,24 @@ void testUpdate()
 
 #else
 
-#define OFFSET_VALUE 0.0f
-bool CircleToBoxCollision(float& cx, float& cy, float radius, float bx, float by, float bw, float bh)
-{
-	const auto halfw = bw * 0.5f;
-	const auto halfh = bh * 0.5f;
-
-	float dx = std::abs(cx - bx);
-	if (dx > halfw + radius)
-		return false;
-
-	float dy = std::abs(cy - by);
-	if (dy > halfh + radius)
-		return false;
-
-	if (dx <= halfw || dy <= halfh)
-	{
-		// change cx or cy
-		if (halfw - dx > halfh - dy) {
-			if (by > cy) {
-				cy = by - halfh - radius - OFFSET_VALUE;
-			}
-			else {
-				cy = by + halfh + radius + OFFSET_VALUE;
-			}
-		}
-		else {
-			if (bx > cx) {
-				cx = bx - halfw - radius - OFFSET_VALUE;
-			}
-			else {
-				cx = bx + halfw + radius + OFFSET_VALUE;
-			}
-		}
-		return true;
-	}
-
-	const float xCornerDist = dx - halfw;
-	const float yCornerDist = dy - halfh;
-	const float xCornerDistSq = xCornerDist * xCornerDist;
-	const float yCornerDistSq = yCornerDist * yCornerDist;
-	const float maxCornerDistSq = radius * radius;
-	if (xCornerDistSq + yCornerDistSq <= maxCornerDistSq)
-	{
-		// change cx & cy
-		auto incX = xCornerDist, incY = yCornerDist;
-		float dSeq = xCornerDistSq + yCornerDistSq;
-		if (dSeq == 0.0f) {
-			incX = halfw + radius / 1.414213562373095f + OFFSET_VALUE;
-			incY = halfh + radius / 1.414213562373095f + OFFSET_VALUE;
-		}
-		else {
-			auto d = ::sqrt(dSeq);
-			incX = halfw + radius * xCornerDist / d + OFFSET_VALUE;
-			incY = halfh + radius * yCornerDist / d + OFFSET_VALUE;
-		}
-		if (cx < bx) {
-			incX = -incX;
-		}
-		if (cy < by) {
-			incY = -incY;
-		}
-		cx = bx + incX;
-		cy = by + incY;
-		return true;
-	}
-	return false;
-}
-#undef OFFSET_VALUE
-
 void testUpdate()
 {
+	// the world steps at its own rate, however long the frame took
+	world.setContinuous(continuous_collision);
+	world.setIterations(static_cast<uint32_t>(solver_iterations));
+	world.setParallelFor(threaded_contacts ? jobsParallelFor : nullptr, &jobs);
+	world.step(ImGui::GetIO().DeltaTime);
+
 	for (auto& circle : circles)
 	{
-		circle->intersects = false;
+		const auto& body = world.getBody(circle->body);
+		circle->x = body.x;
+		circle->y = body.y;
+		circle->intersects = body.touching;
 	}
 	for (auto& rect : rects)
 	{
-		rect->intersects = false;
-		for (auto& circle : circles)
-		{
-			if (CircleToBox(circle->x, circle->y, circle->radius, rect->x, rect->y, rect->w, rect->h))
-			{
-				circle->intersects = true;
-				rect->intersects = true;
-			}
-		}
-	}
-
-
-	//if (clickCircles.empty())
-	{
-		for (auto& rect : rects)
-		{
-			for (auto& circle : circles)
-			{
-				CircleToBoxCollision(circle->x, circle->y, circle->radius, rect->x, rect->y, rect->w, rect->h);
-			}
-		}
+		rect->intersects = world.getBody(rect->body).touching;
 	}
 }
 
@@ -470,6 +443,15 @@ void testUpdate()
 void drawTestWindow()
 {
 	ImGui::Begin("test");
+	ImGui::Checkbox("continuous collision", &continuous_collision);
+	ImGui::SameLine();
+	ImGui::TextDisabled("right drag to fire a projectile");
+	ImGui::SliderInt("solver iterations", &solver_iterations, 1, 32);
+	ImGui::SameLine();
+	ImGui::Checkbox("test pairs on threads", &threaded_contacts);
+	ImGui::SameLine();
+	ImGui::Text("contacts %d, warm started %d, step %d", static_cast<int>(world.getContacts().size()),
+		static_cast<int>(world.getSolver().getWarmStartCount()), static_cast<int>(world.getStepCount()));
 
 	ImDrawList* draw_list = ImGui::GetWindowDrawList();
 
@@ -537,6 +519,7 @@ void drawTestWindow()
 			{
 				circle->x = ImGui::GetIO().MousePos.x - canvas_pos.x - center.x;
 				circle->y = ImGui::GetIO().MousePos.y - canvas_pos.y - center.y;
+				world.moveBody(circle->body, circle->x, circle->y);
 			}
 		}
 
@@ -560,6 +543,25 @@ void drawTestWindow()
 	mouse_pos_in_canvas = ImVec2(ImGui::GetIO().MousePos.x - canvas_pos.x, ImGui::GetIO().MousePos.y - canvas_pos.y);
 	mouse_pos_in_canvas -= center;
 
+	// right drag aims from where it started, the faster the longer
+	static bool aiming = false;
+	static ImVec2 aimStart;
+	if (ImGui::IsItemHovered() && ImGui::IsMouseClicked(1))
+	{
+		aiming = true;
+		aimStart = mouse_pos_in_canvas;
+	}
+	if (aiming)
+	{
+		draw_list->AddLine(canvas_pos + center + aimStart, canvas_pos + center + mouse_pos_in_canvas, IM_COL32(255, 255, 0, 255));
+		if (!ImGui::IsMouseDown(1))
+		{
+			aiming = false;
+			// a quarter of the drag every 60th of a second
+			fireProjectile(aimStart, (mouse_pos_in_canvas - aimStart) * 15.0f);
+		}
+	}
+
 	const float MAX_SPEED = 10.0f;
 
 	for (auto& circle : clickCircles)
@@ -590,6 +592,7 @@ void drawTestWindow()
 
 		circle->x += addx;
 		circle->y += addy;
+		world.moveBody(circle->body, circle->x, circle->y);
 	}
 
 	draw_list->PopClipRect();
@@ -597,6 +600,284 @@ void drawTestWindow()
 	ImGui::End();
 }
 
+typedef std::chrono::high_resolution_clock BenchmarkClock;
+
+inline double elapsedMs(BenchmarkClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count();
+}
+
+inline float randomRange(float min, float max)
+{
+	return min + (max - min) * (std::rand() / static_cast<float>(RAND_MAX));
+}
+
+void drawBenchmarkWindow()
+{
+	ImGui::Begin("benchmark", &show_benchmark);
+
+	// static rects, some of the circles move a few units every frame
+	static int movingCircles = 100;
+	static double bruteForceMs = 0.0;
+	static double sweepMs = 0.0;
+	static size_t sweepSwaps = 0;
+	static size_t sweepPairs = 0;
+	// shown so the compiler can't drop the tests
+	static size_t bruteForceHits = 0;
+	static size_t sweepHits = 0;
+	ImGui::SliderInt("moving circles", &movingCircles, 0, 2000);
+	if (ImGui::Button("2000 rects x 2000 circles, 60 frames"))
+	{
+		const int count = 2000;
+		const int frames = 60;
+		const float range = 4000.0f;
+		std::vector<Rect> boxes(count);
+		std::vector<Circle> balls(count);
+		for (auto& box : boxes)
+		{
+			box.x = randomRange(-range, range);
+			box.y = randomRange(-range, range);
+			box.w = randomRange(20.0f, 80.0f);
+			box.h = randomRange(20.0f, 80.0f);
+		}
+		for (auto& ball : balls)
+		{
+			ball.x = randomRange(-range, range);
+			ball.y = randomRange(-range, range);
+			ball.radius = randomRange(10.0f, 40.0f);
+		}
+		std::vector<ImVec2> moves(count * frames);
+		for (auto& move : moves)
+		{
+			move = ImVec2(randomRange(-3.0f, 3.0f), randomRange(-3.0f, 3.0f));
+		}
+
+		auto start = balls;
+		std::vector<SweepAndPrune::Handle> proxies(count);
+		bruteForceHits = 0;
+		auto begin = BenchmarkClock::now();
+		for (auto frame = 0; frame < frames; ++frame)
+		{
+			for (auto i = 0; i < movingCircles; ++i)
+			{
+				balls[i] += moves[frame * count + i];
+			}
+			for (const auto& box : boxes)
+			{
+				for (const auto& ball : balls)
+				{
+					bruteForceHits += CircleToBox(ball.x, ball.y, ball.radius, box.x, box.y, box.w, box.h) ? 1 : 0;
+				}
+			}
+		}
+		bruteForceMs = elapsedMs(begin) / frames;
+
+		balls = start;
+		SweepAndPrune sweep;
+		for (auto i = 0; i < count; ++i)
+		{
+			const auto& box = boxes[i];
+			sweep.add(box.minx(), box.miny(), box.maxx(), box.maxy(), i, Category_Rect, Category_Circle);
+		}
+		for (auto i = 0; i < count; ++i)
+		{
+			auto& ball = balls[i];
+			proxies[i] = sweep.add(ball.x - ball.radius, ball.y - ball.radius, ball.x + ball.radius, ball.y + ball.radius, -1 - i, Category_Circle, Category_Rect);
+		}
+		std::vector<SweepAndPrune::Pair> pairs;
+		std::vector<SweepAndPrune::Pair> begun;
+		std::vector<SweepAndPrune::Pair> ended;
+		sweep.collectEvents(pairs, ended);
+		// pair key to its index in pairs
+		std::unordered_map<uint64_t, size_t> slots;
+		auto pairKey = [](const SweepAndPrune::Pair& pair)
+		{
+			return (static_cast<uint64_t>(static_cast<uint32_t>(pair.a)) << 32) | static_cast<uint32_t>(pair.b);
+		};
+		for (size_t i = 0; i < pairs.size(); ++i)
+		{
+			slots[pairKey(pairs[i])] = i;
+		}
+
+		sweepSwaps = 0;
+		sweepHits = 0;
+		begin = BenchmarkClock::now();
+		for (auto frame = 0; frame < frames; ++frame)
+		{
+			for (auto i = 0; i < movingCircles; ++i)
+			{
+				auto& ball = balls[i];
+				ball += moves[frame * count + i];
+				sweep.update(proxies[i], ball.x - ball.radius, ball.y - ball.radius, ball.x + ball.radius, ball.y + ball.radius);
+			}
+			sweepSwaps += sweep.getSwapCount();
+			begun.clear();
+			ended.clear();
+			sweep.collectEvents(begun, ended);
+			// an ended pair's slot takes the last pair
+			for (const auto& pair : ended)
+			{
+				auto it = slots.find(pairKey(pair));
+				auto slot = it->second;
+				slots.erase(it);
+				if (slot + 1 != pairs.size())
+				{
+					pairs[slot] = pairs.back();
+					slots[pairKey(pairs[slot])] = slot;
+				}
+				pairs.pop_back();
+			}
+			for (const auto& pair : begun)
+			{
+				slots[pairKey(pair)] = pairs.size();
+				pairs.push_back(pair);
+			}
+
+			for (const auto& pair : pairs)
+			{
+				auto a = sweep.getUserData(pair.a);
+				auto b = sweep.getUserData(pair.b);
+				const auto& box = boxes[a >= 0 ? a : b];
+				const auto& ball = balls[-1 - (a >= 0 ? b : a)];
+				sweepHits += CircleToBox(ball.x, ball.y, ball.radius, box.x, box.y, box.w, box.h) ? 1 : 0;
+			}
+		}
+		sweepMs = elapsedMs(begin) / frames;
+		sweepSwaps /= frames;
+		sweepPairs = pairs.size();
+	}
+	ImGui::Text("every rect x every circle: %.3f ms per frame, %d hits", bruteForceMs, (int)bruteForceHits);
+	ImGui::Text("sweep and prune: %.3f ms per frame, %d swaps, %d pairs, %d hits", sweepMs, (int)sweepSwaps, (int)sweepPairs, (int)sweepHits);
+
+	// the same world stepped with the pairs tested on one thread and on the
+	// jobs, the contacts have to come out the same
+	static double worldSingleMs = 0.0;
+	static double worldJobsMs = 0.0;
+	static size_t worldSingleContacts = 0;
+	static size_t worldJobsContacts = 0;
+	if (ImGui::Button("world, 600 boxes + 6000 circles, 60 steps"))
+	{
+		const int boxCount = 600;
+		const int circleCount = 6000;
+		const int steps = 60;
+		const float range = 3000.0f;
+		CollisionWorld stepped[2];
+		for (auto i = 0; i < boxCount; ++i)
+		{
+			auto x = randomRange(-range, range);
+			auto y = randomRange(-range, range);
+			auto w = randomRange(40.0f, 200.0f);
+			auto h = randomRange(40.0f, 200.0f);
+			for (auto& target : stepped)
+			{
+				target.addBox(x, y, w, h, 0.0f, Category_Rect, Category_Circle);
+			}
+		}
+		for (auto i = 0; i < circleCount; ++i)
+		{
+			auto x = randomRange(-range, range);
+			auto y = randomRange(-range, range);
+			auto radius = randomRange(5.0f, 30.0f);
+			auto vx = randomRange(-200.0f, 200.0f);
+			auto vy = randomRange(-200.0f, 200.0f);
+			for (auto& target : stepped)
+			{
+				auto body = target.addCircle(x, y, radius, 1.0f, Category_Circle, Category_Rect | Category_Circle);
+				target.setVelocity(body, vx, vy);
+			}
+		}
+		stepped[1].setParallelFor(jobsParallelFor, &jobs);
+
+		double* ms[2] = { &worldSingleMs, &worldJobsMs };
+		size_t* contacts[2] = { &worldSingleContacts, &worldJobsContacts };
+		for (auto i = 0; i < 2; ++i)
+		{
+			*contacts[i] = 0;
+			auto begin = BenchmarkClock::now();
+			for (auto step = 0; step < steps; ++step)
+			{
+				stepped[i].fixedStep();
+				*contacts[i] += stepped[i].getContacts().size();
+			}
+			*ms[i] = elapsedMs(begin) / steps;
+		}
+	}
+	ImGui::Text("world step, pairs on 1 thread: %.3f ms, %d contacts", worldSingleMs, (int)worldSingleContacts);
+	ImGui::Text("world step, pairs on %d threads: %.3f ms, %d contacts", (int)jobs.getThreadCount(), worldJobsMs, (int)worldJobsContacts);
+
+	// single thread throughput of every kernel the CPU runs, checked against
+	// CircleToBox on the same data
+	struct KernelResult
+	{
+		CircleToBoxKernel kernel;
+		double circlesPerSecond;
+		double boxesPerSecond;
+		size_t mismatches;
+	};
+	static std::vector<KernelResult> kernelResults;
+	ImGui::Text("batch kernel in use: %s", CircleToBoxKernelName(CircleToBoxGetKernel()));
+	if (ImGui::Button("batch kernels, 4096 shapes x 2000"))
+	{
+		const size_t count = 4096;
+		const int repeats = 2000;
+		std::vector<float> x(count), y(count), radius(count), width(count), height(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			x[i] = randomRange(-500.0f, 500.0f);
+			y[i] = randomRange(-500.0f, 500.0f);
+			radius[i] = randomRange(5.0f, 50.0f);
+			width[i] = randomRange(10.0f, 100.0f);
+			height[i] = randomRange(10.0f, 100.0f);
+		}
+		const CircleArrays circleArrays = { x.data(), y.data(), radius.data(), count };
+		const BoxArrays boxArrays = { x.data(), y.data(), width.data(), height.data(), count };
+		std::vector<uint32_t> masks((count + 31) / 32);
+
+		auto selected = CircleToBoxGetKernel();
+		kernelResults.clear();
+		for (auto kernel : { CircleToBoxKernel_Scalar, CircleToBoxKernel_SSE2, CircleToBoxKernel_AVX2 })
+		{
+			if (!CircleToBoxSetKernel(kernel))
+			{
+				continue;
+			}
+			KernelResult result = { kernel, 0.0, 0.0, 0 };
+			size_t hits = 0;
+			auto begin = BenchmarkClock::now();
+			for (auto repeat = 0; repeat < repeats; ++repeat)
+			{
+				hits += CirclesToBox(circleArrays, x[repeat], y[repeat], width[repeat], height[repeat], masks.data());
+			}
+			result.circlesPerSecond = count * repeats / (elapsedMs(begin) * 0.001);
+			begin = BenchmarkClock::now();
+			for (auto repeat = 0; repeat < repeats; ++repeat)
+			{
+				hits += CircleToBoxes(x[repeat], y[repeat], radius[repeat], boxArrays, masks.data());
+			}
+			result.boxesPerSecond = count * repeats / (elapsedMs(begin) * 0.001);
+
+			for (auto repeat = 0; repeat < 16; ++repeat)
+			{
+				CirclesToBox(circleArrays, x[repeat], y[repeat], width[repeat], height[repeat], masks.data());
+				for (size_t i = 0; i < count; ++i)
+				{
+					auto touches = CircleToBox(x[i], y[i], radius[i], x[repeat], y[repeat], width[repeat], height[repeat]);
+					result.mismatches += touches != (((masks[i / 32] >> (i % 32)) & 1) != 0) ? 1 : 0;
+				}
+			}
+			kernelResults.push_back(result);
+		}
+		CircleToBoxSetKernel(selected);
+	}
+	for (const auto& result : kernelResults)
+	{
+		ImGui::Text("%s: circles %.0f M/s, boxes %.0f M/s, %d mismatches", CircleToBoxKernelName(result.kernel),
+			result.circlesPerSecond * 1e-6, result.boxesPerSecond * 1e-6, (int)result.mismatches);
+	}
+
+	ImGui::End();
+}
+
 void Application_Frame()
 {
 	auto& io = ImGui::GetIO();
@@ -607,6 +888,7 @@ void Application_Frame()
 		if (ImGui::BeginMenu("Tool"))
 		{
 			ImGui::MenuItem("imgui demo", "", &show_imgui_demo);
+			ImGui::MenuItem("benchmark", "", &show_benchmark);
 			ImGui::EndMenu();
 		}
 		ImGui::EndMainMenuBar();
@@ -617,6 +899,11 @@ void Application_Frame()
 		ImGui::ShowDemoWindow(NULL);
 	}
 
+	if (show_benchmark)
+	{
+		drawBenchmarkWindow();
+	}
+
 	drawTestWindow();
 	testUpdate();
 }
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+// Runs chunks of a loop on a fixed set of worker threads. Every thread has
+// its own queue and takes from its back, a thread that runs dry steals from
+// the front of the others, so a chunk that takes long doesn't hold up the
+// rest. The thread calling parallelFor works along as thread 0.
+//
+// Jobs see the index of the thread running them. A result per thread, like
+// ThreadBuffers below, needs no lock and is merged once the loop returns.
+// parallelFor is called from one thread at a time and not from a job.
+class JobSystem
+{
+public:
+
+	// range [begin, end) of the loop on the given thread
+	typedef void (*JobFunction)(void* data, size_t begin, size_t end, uint32_t thread);
+
+	// 0 uses a thread per core
+	explicit JobSystem(uint32_t threadCount = 0);
+
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// the workers and the calling thread
+	uint32_t getThreadCount() const;
+
+	// calls function(begin, end, thread) for chunks of [0, count) and returns
+	// once all of them ran
+	template<typename Function>
+	void parallelFor(size_t count, size_t chunkSize, Function&& function);
+
+	void parallelFor(size_t count, size_t chunkSize, JobFunction function, void* data);
+
+	// about as many items as fit the L1 cache next to the data they touch
+	static size_t chunkSizeFor(size_t itemSize);
+
+	// chunks taken from another thread's queue since the start
+	size_t getStealCount() const;
+
+private:
+
+	struct Job
+	{
+		JobFunction function;
+		void* data;
+		size_t begin;
+		size_t end;
+		std::atomic<size_t>* pending;
+	};
+
+	// the owner and the thieves take the lock, the padding keeps two
+	// queues off the same cache line
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+		char padding[64];
+	};
+
+	void workerLoop(uint32_t thread);
+
+	// own queue first, then the others
+	bool runJob(uint32_t thread);
+
+	bool popJob(uint32_t thread, Job& job);
+
+	bool stealJob(uint32_t thread, Job& job);
+
+private:
+	uint32_t m_threadCount;
+	std::unique_ptr<Queue[]> m_queues;
+	std::vector<std::thread> m_workers;
+	// jobs in all queues, the workers sleep while there are none
+	std::atomic<size_t> m_queued;
+	std::atomic<size_t> m_steals;
+	std::atomic<bool> m_quit;
+	std::mutex m_wakeMutex;
+	std::condition_variable m_wake;
+};
+
+template<typename Function>
+void JobSystem::parallelFor(size_t count, size_t chunkSize, Function&& function)
+{
+	typedef typename std::remove_reference<Function>::type FunctionType;
+	this->parallelFor(count, chunkSize, [](void* data, size_t begin, size_t end, uint32_t thread)
+	{
+		(*static_cast<FunctionType*>(data))(begin, end, thread);
+	}, const_cast<void*>(static_cast<const void*>(&function)));
+}
+
+// One T per thread, each on its own cache lines so threads writing their
+// own don't slow each other down.
+template<typename T>
+class ThreadBuffers
+{
+public:
+
+	explicit ThreadBuffers(uint32_t threadCount)
+		: m_slots(threadCount)
+	{
+	}
+
+	T& operator[](uint32_t thread)
+	{
+		return m_slots[thread].value;
+	}
+
+	const T& operator[](uint32_t thread) const
+	{
+		return m_slots[thread].value;
+	}
+
+	uint32_t size() const
+	{
+		return static_cast<uint32_t>(m_slots.size());
+	}
+
+private:
+
+	struct Slot
+	{
+		T value;
+		char padding[64];
+	};
+
+	std::vector<Slot> m_slots;
+};
@@ -0,0 +1,156 @@
+#include "job/JobSystem.h"
+#include <algorithm>
+
+
+JobSystem::JobSystem(uint32_t threadCount)
+	: m_threadCount(threadCount != 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency()))
+	, m_queues(new Queue[m_threadCount])
+	, m_queued(0)
+	, m_steals(0)
+	, m_quit(false)
+{
+	// thread 0 is whoever calls parallelFor
+	for (uint32_t thread = 1; thread < m_threadCount; ++thread)
+	{
+		m_workers.emplace_back(&JobSystem::workerLoop, this, thread);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+uint32_t JobSystem::getThreadCount() const
+{
+	return m_threadCount;
+}
+
+void JobSystem::parallelFor(size_t count, size_t chunkSize, JobFunction function, void* data)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	chunkSize = std::max<size_t>(1, chunkSize);
+	auto chunks = (count + chunkSize - 1) / chunkSize;
+	std::atomic<size_t> pending(chunks);
+
+	// neighbouring chunks share a queue, a thread stays on its own part of the
+	// data until it runs out and steals
+	m_queued += chunks;
+	for (uint32_t thread = 0; thread < m_threadCount; ++thread)
+	{
+		auto first = chunks * thread / m_threadCount;
+		auto last = chunks * (thread + 1) / m_threadCount;
+		if (first == last)
+		{
+			continue;
+		}
+		auto& queue = m_queues[thread];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		for (auto chunk = first; chunk < last; ++chunk)
+		{
+			queue.jobs.push_back({ function, data, chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize), &pending });
+		}
+	}
+	{
+		// a worker about to sleep either sees the jobs or gets woken
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+	}
+	m_wake.notify_all();
+
+	while (pending.load(std::memory_order_acquire) != 0)
+	{
+		if (!this->runJob(0))
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+size_t JobSystem::chunkSizeFor(size_t itemSize)
+{
+	// half of a 32 KB L1, the rest is for what the items point to
+	return std::max<size_t>(1, 16 * 1024 / std::max<size_t>(1, itemSize));
+}
+
+size_t JobSystem::getStealCount() const
+{
+	return m_steals.load(std::memory_order_relaxed);
+}
+
+void JobSystem::workerLoop(uint32_t thread)
+{
+	while (true)
+	{
+		if (this->runJob(thread))
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wake.wait(lock, [this]()
+		{
+			return m_queued.load() > 0 || m_quit.load();
+		});
+		if (m_quit.load() && m_queued.load() == 0)
+		{
+			return;
+		}
+	}
+}
+
+bool JobSystem::runJob(uint32_t thread)
+{
+	Job job;
+	if (!this->popJob(thread, job) && !this->stealJob(thread, job))
+	{
+		return false;
+	}
+	job.function(job.data, job.begin, job.end, thread);
+	// the results of the job are visible to whoever sees the count drop
+	job.pending->fetch_sub(1, std::memory_order_acq_rel);
+	return true;
+}
+
+bool JobSystem::popJob(uint32_t thread, Job& job)
+{
+	auto& queue = m_queues[thread];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.jobs.empty())
+	{
+		return false;
+	}
+	job = queue.jobs.back();
+	queue.jobs.pop_back();
+	m_queued--;
+	return true;
+}
+
+bool JobSystem::stealJob(uint32_t thread, Job& job)
+{
+	for (uint32_t offset = 1; offset < m_threadCount; ++offset)
+	{
+		auto& queue = m_queues[(thread + offset) % m_threadCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+		{
+			continue;
+		}
+		job = queue.jobs.front();
+		queue.jobs.pop_front();
+		m_queued--;
+		m_steals.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+// Boxes are given by their center (bx, by) and size (bw, bh).
+
+inline bool CircleToBox(float cx, float cy, float radius, float bx, float by, float bw, float bh)
+{
+	const auto halfw = bw * 0.5f;
+	const auto halfh = bh * 0.5f;
+
+	float dx = std::abs(cx - bx);
+	if (dx > halfw + radius)
+		return false;
+
+	float dy = std::abs(cy - by);
+	if (dy > halfh + radius)
+		return false;
+
+	if (dx <= halfw || dy <= halfh)
+		return true;
+
+	const float xCornerDist = dx - halfw;
+	const float yCornerDist = dy - halfh;
+	const float xCornerDistSq = xCornerDist * xCornerDist;
+	const float yCornerDistSq = yCornerDist * yCornerDist;
+	const float maxCornerDistSq = radius * radius;
+	return xCornerDistSq + yCornerDistSq <= maxCornerDistSq;
+}
+
+// squared distance from the point to the closest point of the box, 0 inside
+inline float PointToBoxDistanceSq(float px, float py, float bx, float by, float bw, float bh)
+{
+	const float dx = std::abs(px - bx) - bw * 0.5f;
+	const float dy = std::abs(py - by) - bh * 0.5f;
+	const float xDist = dx > 0.0f ? dx : 0.0f;
+	const float yDist = dy > 0.0f ? dy : 0.0f;
+	return xDist * xDist + yDist * yDist;
+}
+
+// true if the whole box lies inside the circle
+inline bool CircleContainsBox(float cx, float cy, float radius, float bx, float by, float bw, float bh)
+{
+	const float dx = std::abs(cx - bx) + bw * 0.5f;
+	const float dy = std::abs(cy - by) + bh * 0.5f;
+	return dx * dx + dy * dy <= radius * radius;
+}
+
+// Moves the circle at (cx, cy) by (dx, dy) and finds the first touch with the
+// box, as a ray from the circle center against the box grown by the radius
+// with rounded corners. Returns false if the move ends before the touch,
+// otherwise toi is the fraction of the move at the touch and (nx, ny) the
+// unit normal of the box there. A circle already overlapping the box hits at
+// 0 with the normal along which it gets out the quickest.
+inline bool SweptCircleToBox(float cx, float cy, float radius, float dx, float dy, float bx, float by, float bw, float bh,
+	float& toi, float& nx, float& ny)
+{
+	const float halfw = bw * 0.5f;
+	const float halfh = bh * 0.5f;
+	const float px = cx - bx;
+	const float py = cy - by;
+	const float signX = px < 0.0f ? -1.0f : 1.0f;
+	const float signY = py < 0.0f ? -1.0f : 1.0f;
+
+	if (CircleToBox(cx, cy, radius, bx, by, bw, bh))
+	{
+		toi = 0.0f;
+		const float xCornerDist = std::abs(px) - halfw;
+		const float yCornerDist = std::abs(py) - halfh;
+		if (xCornerDist > 0.0f && yCornerDist > 0.0f)
+		{
+			const float d = std::sqrt(xCornerDist * xCornerDist + yCornerDist * yCornerDist);
+			nx = signX * xCornerDist / d;
+			ny = signY * yCornerDist / d;
+		}
+		else if (xCornerDist > yCornerDist)
+		{
+			nx = signX;
+			ny = 0.0f;
+		}
+		else
+		{
+			nx = 0.0f;
+			ny = signY;
+		}
+		return true;
+	}
+
+	// slabs of the grown box, the entering side gives the face normal
+	const float growX = halfw + radius;
+	const float growY = halfh + radius;
+	float enter = 0.0f;
+	float leave = 1.0f;
+	float faceX = 0.0f;
+	float faceY = 0.0f;
+	if (dx == 0.0f)
+	{
+		if (!(std::abs(px) <= growX))
+			return false;
+	}
+	else
+	{
+		float t1 = (-growX - px) / dx;
+		float t2 = (growX - px) / dx;
+		if (t1 > t2)
+			std::swap(t1, t2);
+		if (t1 > enter)
+		{
+			enter = t1;
+			faceX = dx > 0.0f ? -1.0f : 1.0f;
+		}
+		leave = std::min(leave, t2);
+	}
+	if (dy == 0.0f)
+	{
+		if (!(std::abs(py) <= growY))
+			return false;
+	}
+	else
+	{
+		float t1 = (-growY - py) / dy;
+		float t2 = (growY - py) / dy;
+		if (t1 > t2)
+			std::swap(t1, t2);
+		if (t1 > enter)
+		{
+			enter = t1;
+			faceX = 0.0f;
+			faceY = dy > 0.0f ? -1.0f : 1.0f;
+		}
+		leave = std::min(leave, t2);
+	}
+	if (!(enter <= leave))
+		return false;
+
+	const float hitX = px + dx * enter;
+	const float hitY = py + dy * enter;
+	if (std::abs(hitX) <= halfw || std::abs(hitY) <= halfh)
+	{
+		// a face; starting between the slabs of a corner has no face
+		if (faceX == 0.0f && faceY == 0.0f)
+			return false;
+		toi = enter;
+		nx = faceX;
+		ny = faceY;
+		return true;
+	}
+
+	// the rounded corner, missing it misses the whole shape
+	const float mx = px - (hitX < 0.0f ? -halfw : halfw);
+	const float my = py - (hitY < 0.0f ? -halfh : halfh);
+	const float a = dx * dx + dy * dy;
+	const float b = mx * dx + my * dy;
+	const float c = mx * mx + my * my - radius * radius;
+	const float discriminant = b * b - a * c;
+	if (b >= 0.0f || !(discriminant >= 0.0f))
+		return false;
+	const float t = (-b - std::sqrt(discriminant)) / a;
+	if (!(t >= 0.0f && t <= 1.0f))
+		return false;
+	toi = t;
+	nx = (mx + dx * t) / radius;
+	ny = (my + dy * t) / radius;
+	return true;
+}
+
+struct CircleToBoxManifold
+{
+	// unit, from the box toward the circle
+	float normalX;
+	float normalY;
+	// the point of the box surface closest to the circle
+	float pointX;
+	float pointY;
+	// how far the circle has to move along the normal to only touch
+	float penetration;
+};
+
+// CircleToBox that also tells how the two overlap. A circle whose center is
+// inside the box is pushed out through the closest face.
+inline bool CircleToBoxContact(float cx, float cy, float radius, float bx, float by, float bw, float bh, CircleToBoxManifold& manifold)
+{
+	const float halfw = bw * 0.5f;
+	const float halfh = bh * 0.5f;
+	const float px = cx - bx;
+	const float py = cy - by;
+	if (!(std::abs(px) <= halfw + radius && std::abs(py) <= halfh + radius))
+		return false;
+
+	const float qx = std::max(-halfw, std::min(px, halfw));
+	const float qy = std::max(-halfh, std::min(py, halfh));
+	if (qx != px || qy != py)
+	{
+		const float distX = px - qx;
+		const float distY = py - qy;
+		const float dist = std::sqrt(distX * distX + distY * distY);
+		if (dist > radius)
+			return false;
+		manifold.normalX = distX / dist;
+		manifold.normalY = distY / dist;
+		manifold.pointX = bx + qx;
+		manifold.pointY = by + qy;
+		manifold.penetration = radius - dist;
+		return true;
+	}
+
+	const float signX = px < 0.0f ? -1.0f : 1.0f;
+	const float signY = py < 0.0f ? -1.0f : 1.0f;
+	const float faceX = halfw - std::abs(px);
+	const float faceY = halfh - std::abs(py);
+	if (faceX < faceY)
+	{
+		manifold.normalX = signX;
+		manifold.normalY = 0.0f;
+		manifold.pointX = bx + signX * halfw;
+		manifold.pointY = cy;
+		manifold.penetration = faceX + radius;
+	}
+	else
+	{
+		manifold.normalX = 0.0f;
+		manifold.normalY = signY;
+		manifold.pointX = cx;
+		manifold.pointY = by + signY * halfh;
+		manifold.penetration = faceY + radius;
+	}
+	return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// CircleToBox over many shapes at once. The shapes are given as separate
+// float arrays, boxes by center and size like CircleToBox. The result is a
+// bit mask, bit i % 32 of masks[i / 32] is set if shape i touches, and the
+// return value counts the set bits. masks needs (count + 31) / 32 words.
+//
+// The lanes evaluate every early-out of CircleToBox and combine them, so
+// the result matches it bit for bit, NaN included, as long as the compiler
+// doesn't contract the scalar version's multiply-add. The kernel is picked
+// from the CPU on first use.
+
+struct CircleArrays
+{
+	const float* x;
+	const float* y;
+	const float* radius;
+	size_t count;
+};
+
+struct BoxArrays
+{
+	const float* x;
+	const float* y;
+	const float* width;
+	const float* height;
+	size_t count;
+};
+
+enum CircleToBoxKernel
+{
+	CircleToBoxKernel_Scalar,
+	CircleToBoxKernel_SSE2,
+	CircleToBoxKernel_AVX2,
+};
+
+// all circles against one box
+size_t CirclesToBox(const CircleArrays& circles, float bx, float by, float bw, float bh, uint32_t* masks);
+
+// one circle against all boxes
+size_t CircleToBoxes(float cx, float cy, float radius, const BoxArrays& boxes, uint32_t* masks);
+
+CircleToBoxKernel CircleToBoxGetKernel();
+
+bool CircleToBoxIsKernelSupported(CircleToBoxKernel kernel);
+
+// switches to another supported kernel, for comparisons
+bool CircleToBoxSetKernel(CircleToBoxKernel kernel);
+
+const char* CircleToBoxKernelName(CircleToBoxKernel kernel);
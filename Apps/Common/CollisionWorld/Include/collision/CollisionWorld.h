@@ -0,0 +1,190 @@
+#pragma once
+
+#include "collision/CircleToBox.h"
+#include "collision/SweepAndPrune.h"
+#include "collision/ContactSolver.h"
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// Circles and boxes moved in fixed steps, independent of any window or frame
+// rate. step(dt) banks the time it is given and runs as many fixed steps as
+// fit, the same bodies and moves give the same result on any machine.
+//
+// A step moves every body, finds the overlapping pairs with a sort and sweep
+// broadphase, sweeps circles that moved further than their radius against
+// the boxes so they can't pass through, and pushes the bodies apart with the
+// contact solver. Bodies with an inverse mass of 0 are only moved by hand.
+// Two boxes are only tested for overlap, they don't push each other.
+//
+// The pairs can be tested on several threads, setParallelFor hands the world
+// a job system. Every pair writes its own result and the results are added
+// in pair order, so the threads don't change the outcome of a step.
+class CollisionWorld
+{
+public:
+
+	typedef int32_t BodyId;
+
+	// range [begin, end) of a loop on the given thread
+	typedef void (*JobFunction)(void* data, size_t begin, size_t end, uint32_t thread);
+
+	// calls function(data, begin, end, thread) for chunks of [0, count) and
+	// returns once all of them ran
+	typedef void (*ParallelFor)(void* context, size_t count, size_t chunkSize, JobFunction function, void* data);
+
+	enum BodyShape
+	{
+		BodyShape_Circle,
+		BodyShape_Box,
+	};
+
+	struct Body
+	{
+		BodyShape shape;
+		// the center
+		float x;
+		float y;
+		// where the last step started, to draw in between two steps
+		float previousX;
+		float previousY;
+		// per second
+		float velocityX;
+		float velocityY;
+		float radius;
+		float width;
+		float height;
+		float inverseMass;
+		uint32_t category;
+		uint32_t mask;
+		int32_t userData;
+		// touched another body in the last step
+		bool touching;
+
+		// kept by the world
+		bool alive;
+		// a move by hand waiting for the next step
+		bool moved;
+		float moveX;
+		float moveY;
+		SweepAndPrune::Handle proxy;
+		// next free body
+		BodyId next;
+	};
+
+	explicit CollisionWorld(float fixedDt = 1.0f / 60.0f);
+
+	BodyId addCircle(float x, float y, float radius, float inverseMass = 1.0f, uint32_t category = 1, uint32_t mask = ~0u, int32_t userData = 0);
+
+	BodyId addBox(float x, float y, float width, float height, float inverseMass = 0.0f, uint32_t category = 1, uint32_t mask = ~0u, int32_t userData = 0);
+
+	void removeBody(BodyId id);
+
+	const Body& getBody(BodyId id) const;
+
+	// puts the body there without sweeping the way
+	void setPosition(BodyId id, float x, float y);
+
+	// the body travels there in the next step, like it moved there itself
+	void moveBody(BodyId id, float x, float y);
+
+	void setVelocity(BodyId id, float velocityX, float velocityY);
+
+	// Banks dt and runs the fixed steps that fit, at most getMaxSteps; time
+	// that doesn't fit then is dropped. Returns the steps run.
+	uint32_t step(float dt);
+
+	// one fixed step, whatever time is banked
+	void fixedStep();
+
+	// how far into the next step the banked time is, 0 to 1
+	float getInterpolation() const;
+
+	float getFixedDt() const;
+
+	uint32_t getMaxSteps() const;
+
+	void setMaxSteps(uint32_t maxSteps);
+
+	// the fraction of the velocity kept every step
+	void setDamping(float damping);
+
+	void setContinuous(bool continuous);
+
+	void setIterations(uint32_t iterations);
+
+	// null tests the pairs on the calling thread
+	void setParallelFor(ParallelFor parallelFor, void* context);
+
+	// the contacts the last step solved
+	const std::vector<ContactSolver::Contact>& getContacts() const;
+
+	const ContactSolver& getSolver() const;
+
+	uint64_t getStepCount() const;
+
+	size_t getBodyCount() const;
+
+	void clear();
+
+private:
+
+	BodyId addBody(const Body& body);
+
+	void updateProxy(Body& body);
+
+	void collectPairs();
+
+	static uint64_t pairKey(const SweepAndPrune::Pair& pair);
+
+	void sweepCircle(Body& circle, const BodyId* boxes, size_t count);
+
+	void findContacts();
+
+	// the pairs [begin, end) into their m_pairContacts
+	void testPairs(size_t begin, size_t end);
+
+	void solveContacts();
+
+private:
+	float m_fixedDt;
+	float m_accumulator;
+	uint32_t m_maxSteps;
+	float m_damping;
+	bool m_continuous;
+	uint64_t m_stepCount;
+
+	std::vector<Body> m_bodies;
+	BodyId m_freeBody;
+	size_t m_bodyCount;
+
+	SweepAndPrune m_broadphase;
+	// the pairs whose boxes overlap, kept up to date from the events
+	std::vector<SweepAndPrune::Pair> m_pairs;
+	// pair key to its index in m_pairs
+	std::unordered_map<uint64_t, size_t> m_pairSlots;
+	std::vector<SweepAndPrune::Pair> m_begun;
+	std::vector<SweepAndPrune::Pair> m_ended;
+	// circle and box of the pairs to sweep this step
+	std::vector<std::pair<BodyId, BodyId>> m_sweptPairs;
+	std::vector<BodyId> m_sweptBoxes;
+
+	struct PairContact
+	{
+		// box first
+		BodyId a;
+		BodyId b;
+		bool touching;
+		// two boxes only touch
+		bool solve;
+		CircleToBoxManifold manifold;
+	};
+	// what the pair at the same index in m_pairs found this step
+	std::vector<PairContact> m_pairContacts;
+	ParallelFor m_parallelFor;
+	void* m_parallelContext;
+
+	ContactSolver m_solver;
+	std::vector<ContactSolver::Body> m_solverBodies;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// Position based contact solver. The contacts of a step are all gathered
+// first, then the bodies are pushed apart along the contact normals over a
+// fixed number of passes. The result doesn't depend on the order the pairs
+// came in and a step costs the same every frame.
+//
+// A contact adds up its push over the passes and may take some of it back,
+// but never pulls. The push a pair of bodies needed last step is applied
+// before the first pass, so a body resting against a few others starts near
+// where it ends up and doesn't jitter. One contact per pair of bodies.
+class ContactSolver
+{
+public:
+
+	struct Body
+	{
+		float x;
+		float y;
+		// 0 for bodies that don't move
+		float inverseMass;
+	};
+
+	struct Contact
+	{
+		uint32_t bodyA;
+		uint32_t bodyB;
+		// unit, from A toward B
+		float normalX;
+		float normalY;
+		float pointX;
+		float pointY;
+		float penetration;
+		// along the normal, B goes one way and A the other
+		float push;
+	};
+
+	ContactSolver();
+
+	void setIterations(uint32_t iterations);
+
+	uint32_t getIterations() const;
+
+	// drops the contacts of the last step, their pushes are kept
+	void begin();
+
+	void addContact(uint32_t bodyA, uint32_t bodyB, float normalX, float normalY, float pointX, float pointY, float penetration);
+
+	// moves the bodies, the contacts refer to them by index
+	void solve(Body* bodies, size_t count);
+
+	const std::vector<Contact>& getContacts() const;
+
+	// contacts the last solve started with a push from the step before
+	size_t getWarmStartCount() const;
+
+	void clear();
+
+private:
+
+	static uint64_t pairKey(const Contact& contact);
+
+private:
+	std::vector<Contact> m_contacts;
+	// sorted by pair key, from the last solve
+	std::vector<std::pair<uint64_t, float>> m_lastPushes;
+	std::vector<Body> m_start;
+	uint32_t m_iterations;
+	size_t m_warmStartCount;
+};
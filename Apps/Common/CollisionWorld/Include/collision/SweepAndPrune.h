@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// Sort and sweep broadphase with persistent pairs. The min and max endpoints
+// of all boxes stay sorted per axis between frames; moving a box shifts its
+// endpoints by insertion sort, and only the boxes whose endpoints it passes
+// can start or stop overlapping it. A frame where little moves costs about
+// one step per moved box.
+//
+// The overlapping pairs are kept, and the changes since the last call to
+// collectEvents come out as begin and end events. Touching boxes overlap.
+// Two boxes only pair up if the category of each is in the mask of the
+// other. Bounds have to be finite.
+class SweepAndPrune
+{
+public:
+
+	typedef int32_t Handle;
+
+	// a < b
+	struct Pair
+	{
+		Handle a;
+		Handle b;
+	};
+
+	SweepAndPrune();
+
+	Handle add(float minX, float minY, float maxX, float maxY, int32_t userData, uint32_t category = 1, uint32_t mask = ~0u);
+
+	void update(Handle handle, float minX, float minY, float maxX, float maxY);
+
+	// its pairs end, the handle is not reused before the next collectEvents
+	void remove(Handle handle);
+
+	int32_t getUserData(Handle handle) const;
+
+	// Appends the pairs that started and stopped overlapping since the last
+	// call. A pair that did both in between is not reported.
+	void collectEvents(std::vector<Pair>& begun, std::vector<Pair>& ended);
+
+	// the pairs overlapping now
+	void getPairs(std::vector<Pair>& pairs) const;
+
+	size_t getPairCount() const;
+
+	// endpoint swaps since the last collectEvents, the work the frame took
+	size_t getSwapCount() const;
+
+	void clear();
+
+private:
+
+	enum : uint32_t { PairCurrent = 1, PairTouched = 2, PairBefore = 4 };
+
+	struct Endpoint
+	{
+		float value;
+		// proxy << 1 | 1 for max endpoints
+		uint32_t data;
+	};
+
+	struct Proxy
+	{
+		float min[2];
+		float max[2];
+		uint32_t minIndex[2];
+		uint32_t maxIndex[2];
+		int32_t userData;
+		uint32_t category;
+		uint32_t mask;
+		// next free proxy
+		int32_t next;
+	};
+
+	void setBounds(Handle handle, float minX, float minY, float maxX, float maxY);
+
+	void moveEndpoint(uint32_t axis, uint32_t index);
+
+	void swapEndpoints(uint32_t axis, uint32_t index, uint32_t other);
+
+	void setPair(Handle a, Handle b, bool overlapping);
+
+	static bool less(const Endpoint& a, const Endpoint& b);
+
+	static uint64_t pairKey(Handle a, Handle b);
+
+private:
+	std::vector<Endpoint> m_endpoints[2];
+	std::vector<Proxy> m_proxies;
+	int32_t m_freeProxy;
+	// removed since the last collectEvents, freed there
+	std::vector<Handle> m_removed;
+	// pair key to PairCurrent | PairTouched | PairBefore
+	std::unordered_map<uint64_t, uint32_t> m_pairs;
+	std::vector<uint64_t> m_touched;
+	size_t m_pairCount;
+	size_t m_swapCount;
+};
@@ -0,0 +1,337 @@
+#include "collision/CircleToBoxBatch.h"
+#include "collision/CircleToBox.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define CIRCLETOBOX_SIMD_SSE2
+// the AVX2 kernel is compiled for its own target and only called once the
+// CPU reported support
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CIRCLETOBOX_SIMD_AVX2
+#define CIRCLETOBOX_TARGET_AVX2
+#elif defined(__GNUC__)
+#define CIRCLETOBOX_SIMD_AVX2
+#define CIRCLETOBOX_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+
+namespace
+{
+	typedef size_t (*CirclesToBoxFunction)(const CircleArrays& circles, float bx, float by, float bw, float bh, uint32_t* masks);
+	typedef size_t (*CircleToBoxesFunction)(float cx, float cy, float radius, const BoxArrays& boxes, uint32_t* masks);
+
+	uint32_t countBits(uint32_t value)
+	{
+		value = value - ((value >> 1) & 0x55555555u);
+		value = (value & 0x33333333u) + ((value >> 2) & 0x33333333u);
+		return (((value + (value >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+	}
+
+	size_t CirclesToBoxScalar(const CircleArrays& circles, float bx, float by, float bw, float bh, uint32_t* masks)
+	{
+		size_t hits = 0;
+		for (size_t start = 0; start < circles.count; start += 32)
+		{
+			auto count = std::min<size_t>(32, circles.count - start);
+			uint32_t bits = 0;
+			for (size_t lane = 0; lane < count; ++lane)
+			{
+				auto i = start + lane;
+				bits |= static_cast<uint32_t>(CircleToBox(circles.x[i], circles.y[i], circles.radius[i], bx, by, bw, bh)) << lane;
+			}
+			masks[start / 32] = bits;
+			hits += countBits(bits);
+		}
+		return hits;
+	}
+
+	size_t CircleToBoxesScalar(float cx, float cy, float radius, const BoxArrays& boxes, uint32_t* masks)
+	{
+		size_t hits = 0;
+		for (size_t start = 0; start < boxes.count; start += 32)
+		{
+			auto count = std::min<size_t>(32, boxes.count - start);
+			uint32_t bits = 0;
+			for (size_t lane = 0; lane < count; ++lane)
+			{
+				auto i = start + lane;
+				bits |= static_cast<uint32_t>(CircleToBox(cx, cy, radius, boxes.x[i], boxes.y[i], boxes.width[i], boxes.height[i])) << lane;
+			}
+			masks[start / 32] = bits;
+			hits += countBits(bits);
+		}
+		return hits;
+	}
+
+#if defined(CIRCLETOBOX_SIMD_SSE2)
+	// CircleToBox on 4 lanes: past either extent fails, within the side
+	// bands passes, the corner decides the rest. NaN fails the "past" tests
+	// like the scalar early-outs do.
+	inline __m128 touches4(__m128 cx, __m128 cy, __m128 radius, __m128 bx, __m128 by, __m128 halfw, __m128 halfh)
+	{
+		const auto sign = _mm_set1_ps(-0.0f);
+		auto dx = _mm_andnot_ps(sign, _mm_sub_ps(cx, bx));
+		auto dy = _mm_andnot_ps(sign, _mm_sub_ps(cy, by));
+		auto outside = _mm_or_ps(_mm_cmpgt_ps(dx, _mm_add_ps(halfw, radius)), _mm_cmpgt_ps(dy, _mm_add_ps(halfh, radius)));
+		auto side = _mm_or_ps(_mm_cmple_ps(dx, halfw), _mm_cmple_ps(dy, halfh));
+		auto xCornerDist = _mm_sub_ps(dx, halfw);
+		auto yCornerDist = _mm_sub_ps(dy, halfh);
+		auto cornerDistSq = _mm_add_ps(_mm_mul_ps(xCornerDist, xCornerDist), _mm_mul_ps(yCornerDist, yCornerDist));
+		auto corner = _mm_cmple_ps(cornerDistSq, _mm_mul_ps(radius, radius));
+		return _mm_andnot_ps(outside, _mm_or_ps(side, corner));
+	}
+
+	size_t CirclesToBoxSSE2(const CircleArrays& circles, float bx, float by, float bw, float bh, uint32_t* masks)
+	{
+		const auto boxX = _mm_set1_ps(bx);
+		const auto boxY = _mm_set1_ps(by);
+		const auto halfw = _mm_set1_ps(bw * 0.5f);
+		const auto halfh = _mm_set1_ps(bh * 0.5f);
+		size_t hits = 0;
+		for (size_t start = 0; start < circles.count; start += 32)
+		{
+			auto count = std::min<size_t>(32, circles.count - start);
+			uint32_t bits = 0;
+			size_t lane = 0;
+			for (; lane + 4 <= count; lane += 4)
+			{
+				auto i = start + lane;
+				auto touches = touches4(_mm_loadu_ps(circles.x + i), _mm_loadu_ps(circles.y + i), _mm_loadu_ps(circles.radius + i), boxX, boxY, halfw, halfh);
+				bits |= static_cast<uint32_t>(_mm_movemask_ps(touches)) << lane;
+			}
+			for (; lane < count; ++lane)
+			{
+				auto i = start + lane;
+				bits |= static_cast<uint32_t>(CircleToBox(circles.x[i], circles.y[i], circles.radius[i], bx, by, bw, bh)) << lane;
+			}
+			masks[start / 32] = bits;
+			hits += countBits(bits);
+		}
+		return hits;
+	}
+
+	size_t CircleToBoxesSSE2(float cx, float cy, float radius, const BoxArrays& boxes, uint32_t* masks)
+	{
+		const auto circleX = _mm_set1_ps(cx);
+		const auto circleY = _mm_set1_ps(cy);
+		const auto circleRadius = _mm_set1_ps(radius);
+		const auto half = _mm_set1_ps(0.5f);
+		size_t hits = 0;
+		for (size_t start = 0; start < boxes.count; start += 32)
+		{
+			auto count = std::min<size_t>(32, boxes.count - start);
+			uint32_t bits = 0;
+			size_t lane = 0;
+			for (; lane + 4 <= count; lane += 4)
+			{
+				auto i = start + lane;
+				auto halfw = _mm_mul_ps(_mm_loadu_ps(boxes.width + i), half);
+				auto halfh = _mm_mul_ps(_mm_loadu_ps(boxes.height + i), half);
+				auto touches = touches4(circleX, circleY, circleRadius, _mm_loadu_ps(boxes.x + i), _mm_loadu_ps(boxes.y + i), halfw, halfh);
+				bits |= static_cast<uint32_t>(_mm_movemask_ps(touches)) << lane;
+			}
+			for (; lane < count; ++lane)
+			{
+				auto i = start + lane;
+				bits |= static_cast<uint32_t>(CircleToBox(cx, cy, radius, boxes.x[i], boxes.y[i], boxes.width[i], boxes.height[i])) << lane;
+			}
+			masks[start / 32] = bits;
+			hits += countBits(bits);
+		}
+		return hits;
+	}
+#endif
+
+#if defined(CIRCLETOBOX_SIMD_AVX2)
+	// touches4 on 8 lanes
+	CIRCLETOBOX_TARGET_AVX2 inline __m256 touches8(__m256 cx, __m256 cy, __m256 radius, __m256 bx, __m256 by, __m256 halfw, __m256 halfh)
+	{
+		const auto sign = _mm256_set1_ps(-0.0f);
+		auto dx = _mm256_andnot_ps(sign, _mm256_sub_ps(cx, bx));
+		auto dy = _mm256_andnot_ps(sign, _mm256_sub_ps(cy, by));
+		auto outside = _mm256_or_ps(_mm256_cmp_ps(dx, _mm256_add_ps(halfw, radius), _CMP_GT_OQ), _mm256_cmp_ps(dy, _mm256_add_ps(halfh, radius), _CMP_GT_OQ));
+		auto side = _mm256_or_ps(_mm256_cmp_ps(dx, halfw, _CMP_LE_OQ), _mm256_cmp_ps(dy, halfh, _CMP_LE_OQ));
+		auto xCornerDist = _mm256_sub_ps(dx, halfw);
+		auto yCornerDist = _mm256_sub_ps(dy, halfh);
+		auto cornerDistSq = _mm256_add_ps(_mm256_mul_ps(xCornerDist, xCornerDist), _mm256_mul_ps(yCornerDist, yCornerDist));
+		auto corner = _mm256_cmp_ps(cornerDistSq, _mm256_mul_ps(radius, radius), _CMP_LE_OQ);
+		return _mm256_andnot_ps(outside, _mm256_or_ps(side, corner));
+	}
+
+	CIRCLETOBOX_TARGET_AVX2 size_t CirclesToBoxAVX2(const CircleArrays& circles, float bx, float by, float bw, float bh, uint32_t* masks)
+	{
+		const auto boxX = _mm256_set1_ps(bx);
+		const auto boxY = _mm256_set1_ps(by);
+		const auto halfw = _mm256_set1_ps(bw * 0.5f);
+		const auto halfh = _mm256_set1_ps(bh * 0.5f);
+		size_t hits = 0;
+		for (size_t start = 0; start < circles.count; start += 32)
+		{
+			auto count = std::min<size_t>(32, circles.count - start);
+			uint32_t bits = 0;
+			size_t lane = 0;
+			for (; lane + 8 <= count; lane += 8)
+			{
+				auto i = start + lane;
+				auto touches = touches8(_mm256_loadu_ps(circles.x + i), _mm256_loadu_ps(circles.y + i), _mm256_loadu_ps(circles.radius + i), boxX, boxY, halfw, halfh);
+				bits |= static_cast<uint32_t>(_mm256_movemask_ps(touches)) << lane;
+			}
+			for (; lane < count; ++lane)
+			{
+				auto i = start + lane;
+				bits |= static_cast<uint32_t>(CircleToBox(circles.x[i], circles.y[i], circles.radius[i], bx, by, bw, bh)) << lane;
+			}
+			masks[start / 32] = bits;
+			hits += countBits(bits);
+		}
+		return hits;
+	}
+
+	CIRCLETOBOX_TARGET_AVX2 size_t CircleToBoxesAVX2(float cx, float cy, float radius, const BoxArrays& boxes, uint32_t* masks)
+	{
+		const auto circleX = _mm256_set1_ps(cx);
+		const auto circleY = _mm256_set1_ps(cy);
+		const auto circleRadius = _mm256_set1_ps(radius);
+		const auto half = _mm256_set1_ps(0.5f);
+		size_t hits = 0;
+		for (size_t start = 0; start < boxes.count; start += 32)
+		{
+			auto count = std::min<size_t>(32, boxes.count - start);
+			uint32_t bits = 0;
+			size_t lane = 0;
+			for (; lane + 8 <= count; lane += 8)
+			{
+				auto i = start + lane;
+				auto halfw = _mm256_mul_ps(_mm256_loadu_ps(boxes.width + i), half);
+				auto halfh = _mm256_mul_ps(_mm256_loadu_ps(boxes.height + i), half);
+				auto touches = touches8(circleX, circleY, circleRadius, _mm256_loadu_ps(boxes.x + i), _mm256_loadu_ps(boxes.y + i), halfw, halfh);
+				bits |= static_cast<uint32_t>(_mm256_movemask_ps(touches)) << lane;
+			}
+			for (; lane < count; ++lane)
+			{
+				auto i = start + lane;
+				bits |= static_cast<uint32_t>(CircleToBox(cx, cy, radius, boxes.x[i], boxes.y[i], boxes.width[i], boxes.height[i])) << lane;
+			}
+			masks[start / 32] = bits;
+			hits += countBits(bits);
+		}
+		return hits;
+	}
+#endif
+
+	bool cpuSupportsAVX2()
+	{
+#if defined(CIRCLETOBOX_SIMD_AVX2) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+		{
+			return false;
+		}
+		// the OS has to save the ymm registers too
+		__cpuid(info, 1);
+		if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6)
+		{
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#elif defined(CIRCLETOBOX_SIMD_AVX2)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#else
+		return false;
+#endif
+	}
+
+	struct Kernels
+	{
+		CircleToBoxKernel kernel;
+		CirclesToBoxFunction circlesToBox;
+		CircleToBoxesFunction circleToBoxes;
+	};
+
+	bool selectKernel(Kernels& kernels, CircleToBoxKernel kernel)
+	{
+		switch (kernel)
+		{
+		case CircleToBoxKernel_Scalar:
+			kernels = { kernel, CirclesToBoxScalar, CircleToBoxesScalar };
+			return true;
+#if defined(CIRCLETOBOX_SIMD_SSE2)
+		case CircleToBoxKernel_SSE2:
+			kernels = { kernel, CirclesToBoxSSE2, CircleToBoxesSSE2 };
+			return true;
+#endif
+#if defined(CIRCLETOBOX_SIMD_AVX2)
+		case CircleToBoxKernel_AVX2:
+			if (!cpuSupportsAVX2())
+			{
+				return false;
+			}
+			kernels = { kernel, CirclesToBoxAVX2, CircleToBoxesAVX2 };
+			return true;
+#endif
+		default:
+			return false;
+		}
+	}
+
+	// the widest kernel the CPU runs, picked on first use
+	Kernels& getKernels()
+	{
+		static Kernels kernels = []()
+		{
+			Kernels best;
+			if (!selectKernel(best, CircleToBoxKernel_AVX2) && !selectKernel(best, CircleToBoxKernel_SSE2))
+			{
+				selectKernel(best, CircleToBoxKernel_Scalar);
+			}
+			return best;
+		}();
+		return kernels;
+	}
+}
+
+size_t CirclesToBox(const CircleArrays& circles, float bx, float by, float bw, float bh, uint32_t* masks)
+{
+	return getKernels().circlesToBox(circles, bx, by, bw, bh, masks);
+}
+
+size_t CircleToBoxes(float cx, float cy, float radius, const BoxArrays& boxes, uint32_t* masks)
+{
+	return getKernels().circleToBoxes(cx, cy, radius, boxes, masks);
+}
+
+CircleToBoxKernel CircleToBoxGetKernel()
+{
+	return getKernels().kernel;
+}
+
+bool CircleToBoxIsKernelSupported(CircleToBoxKernel kernel)
+{
+	Kernels kernels;
+	return selectKernel(kernels, kernel);
+}
+
+bool CircleToBoxSetKernel(CircleToBoxKernel kernel)
+{
+	return selectKernel(getKernels(), kernel);
+}
+
+const char* CircleToBoxKernelName(CircleToBoxKernel kernel)
+{
+	switch (kernel)
+	{
+	case CircleToBoxKernel_Scalar:
+		return "scalar";
+	case CircleToBoxKernel_SSE2:
+		return "SSE2";
+	case CircleToBoxKernel_AVX2:
+		return "AVX2";
+	}
+	return "";
+}
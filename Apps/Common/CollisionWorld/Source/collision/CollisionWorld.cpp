@@ -0,0 +1,548 @@
+#include "collision/CollisionWorld.h"
+#include "collision/CircleToBox.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+
+namespace
+{
+	// normal from the first circle to the second
+	bool CircleToCircleContact(float ax, float ay, float aRadius, float bx, float by, float bRadius, CircleToBoxManifold& manifold)
+	{
+		const float dx = bx - ax;
+		const float dy = by - ay;
+		const float reach = aRadius + bRadius;
+		const float distSq = dx * dx + dy * dy;
+		if (!(distSq <= reach * reach))
+			return false;
+
+		const float dist = std::sqrt(distSq);
+		if (dist > 0.0f)
+		{
+			manifold.normalX = dx / dist;
+			manifold.normalY = dy / dist;
+		}
+		else
+		{
+			manifold.normalX = 1.0f;
+			manifold.normalY = 0.0f;
+		}
+		manifold.pointX = ax + manifold.normalX * aRadius;
+		manifold.pointY = ay + manifold.normalY * aRadius;
+		manifold.penetration = reach - dist;
+		return true;
+	}
+
+	bool BoxToBox(const CollisionWorld::Body& a, const CollisionWorld::Body& b)
+	{
+		return !(std::abs(a.x - b.x) * 2.0f > a.width + b.width || std::abs(a.y - b.y) * 2.0f > a.height + b.height);
+	}
+}
+
+CollisionWorld::CollisionWorld(float fixedDt)
+	: m_fixedDt(fixedDt)
+	, m_accumulator(0.0f)
+	, m_maxSteps(8)
+	, m_damping(1.0f)
+	, m_continuous(true)
+	, m_stepCount(0)
+	, m_freeBody(-1)
+	, m_bodyCount(0)
+	, m_parallelFor(nullptr)
+	, m_parallelContext(nullptr)
+{
+}
+
+CollisionWorld::BodyId CollisionWorld::addCircle(float x, float y, float radius, float inverseMass, uint32_t category, uint32_t mask, int32_t userData)
+{
+	Body body = {};
+	body.shape = BodyShape_Circle;
+	body.x = x;
+	body.y = y;
+	body.radius = radius;
+	body.width = radius * 2.0f;
+	body.height = radius * 2.0f;
+	body.inverseMass = inverseMass;
+	body.category = category;
+	body.mask = mask;
+	body.userData = userData;
+	return this->addBody(body);
+}
+
+CollisionWorld::BodyId CollisionWorld::addBox(float x, float y, float width, float height, float inverseMass, uint32_t category, uint32_t mask, int32_t userData)
+{
+	Body body = {};
+	body.shape = BodyShape_Box;
+	body.x = x;
+	body.y = y;
+	body.width = width;
+	body.height = height;
+	body.inverseMass = inverseMass;
+	body.category = category;
+	body.mask = mask;
+	body.userData = userData;
+	return this->addBody(body);
+}
+
+CollisionWorld::BodyId CollisionWorld::addBody(const Body& body)
+{
+	BodyId id;
+	if (m_freeBody != -1)
+	{
+		id = m_freeBody;
+		m_freeBody = m_bodies[id].next;
+	}
+	else
+	{
+		id = static_cast<BodyId>(m_bodies.size());
+		m_bodies.push_back(Body());
+	}
+
+	auto& added = m_bodies[id];
+	added = body;
+	added.previousX = body.x;
+	added.previousY = body.y;
+	added.alive = true;
+	added.moved = false;
+	added.next = -1;
+	added.proxy = m_broadphase.add(body.x - body.width * 0.5f, body.y - body.height * 0.5f, body.x + body.width * 0.5f, body.y + body.height * 0.5f,
+		id, body.category, body.mask);
+	m_bodyCount++;
+	return id;
+}
+
+void CollisionWorld::removeBody(BodyId id)
+{
+	// the pairs of the proxy end with the next events, before the id is seen again
+	auto& body = m_bodies[id];
+	assert(body.alive);
+	m_broadphase.remove(body.proxy);
+	body.alive = false;
+	body.next = m_freeBody;
+	m_freeBody = id;
+	m_bodyCount--;
+}
+
+const CollisionWorld::Body& CollisionWorld::getBody(BodyId id) const
+{
+	return m_bodies[id];
+}
+
+void CollisionWorld::setPosition(BodyId id, float x, float y)
+{
+	auto& body = m_bodies[id];
+	body.x = x;
+	body.y = y;
+	body.previousX = x;
+	body.previousY = y;
+	body.moved = false;
+	this->updateProxy(body);
+}
+
+void CollisionWorld::moveBody(BodyId id, float x, float y)
+{
+	auto& body = m_bodies[id];
+	body.moved = true;
+	body.moveX = x;
+	body.moveY = y;
+}
+
+void CollisionWorld::setVelocity(BodyId id, float velocityX, float velocityY)
+{
+	auto& body = m_bodies[id];
+	body.velocityX = velocityX;
+	body.velocityY = velocityY;
+}
+
+uint32_t CollisionWorld::step(float dt)
+{
+	if (dt > 0.0f)
+	{
+		m_accumulator += dt;
+	}
+
+	uint32_t steps = 0;
+	while (m_accumulator >= m_fixedDt && steps < m_maxSteps)
+	{
+		this->fixedStep();
+		m_accumulator -= m_fixedDt;
+		steps++;
+	}
+
+	// too far behind to catch up, slow down rather than fall further behind
+	if (m_accumulator >= m_fixedDt)
+	{
+		m_accumulator = std::fmod(m_accumulator, m_fixedDt);
+	}
+	return steps;
+}
+
+void CollisionWorld::fixedStep()
+{
+	// everything moves first, by hand or by its velocity
+	for (auto& body : m_bodies)
+	{
+		if (!body.alive)
+		{
+			continue;
+		}
+		body.previousX = body.x;
+		body.previousY = body.y;
+		if (body.moved)
+		{
+			body.x = body.moveX;
+			body.y = body.moveY;
+			body.moved = false;
+		}
+		else
+		{
+			body.x += body.velocityX * m_fixedDt;
+			body.y += body.velocityY * m_fixedDt;
+		}
+		body.velocityX *= m_damping;
+		body.velocityY *= m_damping;
+		body.touching = false;
+		this->updateProxy(body);
+	}
+	this->collectPairs();
+
+	// A circle that moved further than its radius can have passed through a
+	// box, or be pushed out on its far side. Only those pairs are swept, the
+	// solver handles the rest.
+	if (m_continuous)
+	{
+		m_sweptPairs.clear();
+		for (const auto& pair : m_pairs)
+		{
+			auto a = m_broadphase.getUserData(pair.a);
+			auto b = m_broadphase.getUserData(pair.b);
+			if (m_bodies[a].shape != BodyShape_Circle)
+			{
+				std::swap(a, b);
+			}
+			const auto& circle = m_bodies[a];
+			if (circle.shape != BodyShape_Circle || m_bodies[b].shape != BodyShape_Box || circle.inverseMass <= 0.0f)
+			{
+				continue;
+			}
+			auto moveX = circle.x - circle.previousX;
+			auto moveY = circle.y - circle.previousY;
+			if (moveX * moveX + moveY * moveY > circle.radius * circle.radius)
+			{
+				m_sweptPairs.push_back(std::make_pair(a, b));
+			}
+		}
+		std::sort(m_sweptPairs.begin(), m_sweptPairs.end());
+		for (size_t i = 0; i < m_sweptPairs.size();)
+		{
+			auto circle = m_sweptPairs[i].first;
+			m_sweptBoxes.clear();
+			for (; i < m_sweptPairs.size() && m_sweptPairs[i].first == circle; ++i)
+			{
+				m_sweptBoxes.push_back(m_sweptPairs[i].second);
+			}
+			this->sweepCircle(m_bodies[circle], m_sweptBoxes.data(), m_sweptBoxes.size());
+		}
+	}
+
+	this->findContacts();
+	this->solveContacts();
+	m_stepCount++;
+}
+
+float CollisionWorld::getInterpolation() const
+{
+	return m_accumulator / m_fixedDt;
+}
+
+float CollisionWorld::getFixedDt() const
+{
+	return m_fixedDt;
+}
+
+uint32_t CollisionWorld::getMaxSteps() const
+{
+	return m_maxSteps;
+}
+
+void CollisionWorld::setMaxSteps(uint32_t maxSteps)
+{
+	m_maxSteps = maxSteps;
+}
+
+void CollisionWorld::setDamping(float damping)
+{
+	m_damping = damping;
+}
+
+void CollisionWorld::setContinuous(bool continuous)
+{
+	m_continuous = continuous;
+}
+
+void CollisionWorld::setIterations(uint32_t iterations)
+{
+	m_solver.setIterations(iterations);
+}
+
+void CollisionWorld::setParallelFor(ParallelFor parallelFor, void* context)
+{
+	m_parallelFor = parallelFor;
+	m_parallelContext = context;
+}
+
+const std::vector<ContactSolver::Contact>& CollisionWorld::getContacts() const
+{
+	return m_solver.getContacts();
+}
+
+const ContactSolver& CollisionWorld::getSolver() const
+{
+	return m_solver;
+}
+
+uint64_t CollisionWorld::getStepCount() const
+{
+	return m_stepCount;
+}
+
+size_t CollisionWorld::getBodyCount() const
+{
+	return m_bodyCount;
+}
+
+void CollisionWorld::clear()
+{
+	m_accumulator = 0.0f;
+	m_stepCount = 0;
+	m_bodies.clear();
+	m_freeBody = -1;
+	m_bodyCount = 0;
+	m_broadphase.clear();
+	m_pairs.clear();
+	m_pairSlots.clear();
+	m_solver.clear();
+}
+
+void CollisionWorld::updateProxy(Body& body)
+{
+	if (body.shape == BodyShape_Circle)
+	{
+		// Centered on where the circle started and as far as the move. A
+		// swept path that slides or bounces is no longer than the move, so
+		// every box it can hit is paired.
+		auto moveX = body.x - body.previousX;
+		auto moveY = body.y - body.previousY;
+		auto reach = body.radius + std::sqrt(moveX * moveX + moveY * moveY);
+		m_broadphase.update(body.proxy, body.previousX - reach, body.previousY - reach, body.previousX + reach, body.previousY + reach);
+		return;
+	}
+
+	auto halfw = body.width * 0.5f;
+	auto halfh = body.height * 0.5f;
+	m_broadphase.update(body.proxy, std::min(body.x, body.previousX) - halfw, std::min(body.y, body.previousY) - halfh,
+		std::max(body.x, body.previousX) + halfw, std::max(body.y, body.previousY) + halfh);
+}
+
+void CollisionWorld::collectPairs()
+{
+	m_begun.clear();
+	m_ended.clear();
+	m_broadphase.collectEvents(m_begun, m_ended);
+
+	// an ended pair's slot takes the last pair, the work follows the events
+	// and not the number of pairs
+	for (const auto& pair : m_ended)
+	{
+		auto it = m_pairSlots.find(pairKey(pair));
+		auto slot = it->second;
+		m_pairSlots.erase(it);
+		if (slot + 1 != m_pairs.size())
+		{
+			m_pairs[slot] = m_pairs.back();
+			m_pairSlots[pairKey(m_pairs[slot])] = slot;
+		}
+		m_pairs.pop_back();
+	}
+	for (const auto& pair : m_begun)
+	{
+		m_pairSlots[pairKey(pair)] = m_pairs.size();
+		m_pairs.push_back(pair);
+	}
+}
+
+uint64_t CollisionWorld::pairKey(const SweepAndPrune::Pair& pair)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(pair.a)) << 32) | static_cast<uint32_t>(pair.b);
+}
+
+// Sweeps the circle from where the step started to where it is now against
+// the boxes and stops it at the first hit. The rest of the move slides along
+// the box, or bounces off it if the circle flies on its own, and is swept
+// again.
+void CollisionWorld::sweepCircle(Body& circle, const BodyId* boxes, size_t count)
+{
+	const int MAX_SWEEPS = 4;
+	auto startX = circle.previousX;
+	auto startY = circle.previousY;
+	auto moveX = circle.x - startX;
+	auto moveY = circle.y - startY;
+	auto bounce = circle.velocityX != 0.0f || circle.velocityY != 0.0f ? 2.0f : 1.0f;
+	for (int sweep = 0; sweep < MAX_SWEEPS; ++sweep)
+	{
+		auto first = 1.0f;
+		auto normalX = 0.0f;
+		auto normalY = 0.0f;
+		auto hit = false;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto& box = m_bodies[boxes[i]];
+			float toi, nx, ny;
+			// resting against a box or leaving it is no hit
+			if (SweptCircleToBox(startX, startY, circle.radius, moveX, moveY, box.x, box.y, box.width, box.height, toi, nx, ny)
+				&& nx * moveX + ny * moveY < 0.0f && toi <= first)
+			{
+				first = toi;
+				normalX = nx;
+				normalY = ny;
+				hit = true;
+			}
+		}
+		if (!hit)
+		{
+			circle.x = startX + moveX;
+			circle.y = startY + moveY;
+			return;
+		}
+
+		startX += moveX * first;
+		startY += moveY * first;
+		moveX *= 1.0f - first;
+		moveY *= 1.0f - first;
+		auto along = (moveX * normalX + moveY * normalY) * bounce;
+		moveX -= normalX * along;
+		moveY -= normalY * along;
+		auto velocityAlong = (circle.velocityX * normalX + circle.velocityY * normalY) * bounce;
+		circle.velocityX -= normalX * velocityAlong;
+		circle.velocityY -= normalY * velocityAlong;
+	}
+	circle.x = startX;
+	circle.y = startY;
+}
+
+// all contacts are found before anything moves
+void CollisionWorld::findContacts()
+{
+	// a few pairs are done before the threads wake up
+	const size_t ChunkSize = 256;
+
+	m_pairContacts.resize(m_pairs.size());
+	if (m_parallelFor != nullptr && m_pairs.size() > ChunkSize)
+	{
+		m_parallelFor(m_parallelContext, m_pairs.size(), ChunkSize, [](void* data, size_t begin, size_t end, uint32_t)
+		{
+			static_cast<CollisionWorld*>(data)->testPairs(begin, end);
+		}, this);
+	}
+	else
+	{
+		this->testPairs(0, m_pairs.size());
+	}
+
+	// in pair order, whatever thread found them
+	m_solver.begin();
+	for (const auto& contact : m_pairContacts)
+	{
+		if (!contact.touching)
+		{
+			continue;
+		}
+		m_bodies[contact.a].touching = true;
+		m_bodies[contact.b].touching = true;
+		if (contact.solve)
+		{
+			const auto& manifold = contact.manifold;
+			m_solver.addContact(static_cast<uint32_t>(contact.a), static_cast<uint32_t>(contact.b), manifold.normalX, manifold.normalY,
+				manifold.pointX, manifold.pointY, manifold.penetration);
+		}
+	}
+}
+
+void CollisionWorld::testPairs(size_t begin, size_t end)
+{
+	// only reads the bodies, two pairs of one body can be on two threads
+	for (auto i = begin; i < end; ++i)
+	{
+		const auto& pair = m_pairs[i];
+		auto a = m_broadphase.getUserData(pair.a);
+		auto b = m_broadphase.getUserData(pair.b);
+		// boxes go first, they are the A side of their contacts
+		if (m_bodies[a].shape == BodyShape_Circle && (m_bodies[b].shape == BodyShape_Box || b < a))
+		{
+			std::swap(a, b);
+		}
+		const auto& bodyA = m_bodies[a];
+		const auto& bodyB = m_bodies[b];
+
+		auto& contact = m_pairContacts[i];
+		contact.a = a;
+		contact.b = b;
+		contact.solve = false;
+		if (bodyA.shape == BodyShape_Box && bodyB.shape == BodyShape_Box)
+		{
+			contact.touching = BoxToBox(bodyA, bodyB);
+			continue;
+		}
+		else if (bodyA.shape == BodyShape_Box)
+		{
+			contact.touching = CircleToBoxContact(bodyB.x, bodyB.y, bodyB.radius, bodyA.x, bodyA.y, bodyA.width, bodyA.height, contact.manifold);
+		}
+		else
+		{
+			contact.touching = CircleToCircleContact(bodyA.x, bodyA.y, bodyA.radius, bodyB.x, bodyB.y, bodyB.radius, contact.manifold);
+		}
+		contact.solve = contact.touching && bodyA.inverseMass + bodyB.inverseMass > 0.0f;
+	}
+}
+
+void CollisionWorld::solveContacts()
+{
+	m_solverBodies.resize(m_bodies.size());
+	for (size_t i = 0; i < m_bodies.size(); ++i)
+	{
+		const auto& body = m_bodies[i];
+		m_solverBodies[i] = { body.x, body.y, body.alive ? body.inverseMass : 0.0f };
+	}
+	m_solver.solve(m_solverBodies.data(), m_solverBodies.size());
+	for (size_t i = 0; i < m_bodies.size(); ++i)
+	{
+		auto& body = m_bodies[i];
+		body.x = m_solverBodies[i].x;
+		body.y = m_solverBodies[i].y;
+	}
+
+	// what still moves into a contact that pushed is stopped
+	for (const auto& contact : m_solver.getContacts())
+	{
+		if (contact.push <= 0.0f)
+		{
+			continue;
+		}
+		auto& a = m_bodies[contact.bodyA];
+		auto& b = m_bodies[contact.bodyB];
+		auto alongA = a.velocityX * contact.normalX + a.velocityY * contact.normalY;
+		if (a.inverseMass > 0.0f && alongA > 0.0f)
+		{
+			a.velocityX -= contact.normalX * alongA;
+			a.velocityY -= contact.normalY * alongA;
+		}
+		auto alongB = b.velocityX * contact.normalX + b.velocityY * contact.normalY;
+		if (b.inverseMass > 0.0f && alongB < 0.0f)
+		{
+			b.velocityX -= contact.normalX * alongB;
+			b.velocityY -= contact.normalY * alongB;
+		}
+	}
+}
@@ -0,0 +1,131 @@
+#include "collision/ContactSolver.h"
+#include <algorithm>
+
+
+ContactSolver::ContactSolver()
+	: m_iterations(8)
+	, m_warmStartCount(0)
+{
+}
+
+void ContactSolver::setIterations(uint32_t iterations)
+{
+	m_iterations = iterations;
+}
+
+uint32_t ContactSolver::getIterations() const
+{
+	return m_iterations;
+}
+
+void ContactSolver::begin()
+{
+	m_contacts.clear();
+}
+
+void ContactSolver::addContact(uint32_t bodyA, uint32_t bodyB, float normalX, float normalY, float pointX, float pointY, float penetration)
+{
+	Contact contact;
+	contact.bodyA = bodyA;
+	contact.bodyB = bodyB;
+	contact.normalX = normalX;
+	contact.normalY = normalY;
+	contact.pointX = pointX;
+	contact.pointY = pointY;
+	contact.penetration = penetration;
+	contact.push = 0.0f;
+	m_contacts.push_back(contact);
+}
+
+void ContactSolver::solve(Body* bodies, size_t count)
+{
+	// the same contacts solve the same way whatever order they were added in
+	std::sort(m_contacts.begin(), m_contacts.end(), [](const Contact& a, const Contact& b)
+	{
+		return pairKey(a) < pairKey(b);
+	});
+	m_start.assign(bodies, bodies + count);
+
+	auto applyPush = [bodies](const Contact& contact, float push)
+	{
+		auto& a = bodies[contact.bodyA];
+		auto& b = bodies[contact.bodyB];
+		a.x -= contact.normalX * push * a.inverseMass;
+		a.y -= contact.normalY * push * a.inverseMass;
+		b.x += contact.normalX * push * b.inverseMass;
+		b.y += contact.normalY * push * b.inverseMass;
+	};
+
+	// both lists are sorted by key, walk them side by side
+	m_warmStartCount = 0;
+	auto last = m_lastPushes.begin();
+	for (auto& contact : m_contacts)
+	{
+		auto key = pairKey(contact);
+		while (last != m_lastPushes.end() && last->first < key)
+		{
+			++last;
+		}
+		if (last != m_lastPushes.end() && last->first == key)
+		{
+			contact.push = last->second;
+			applyPush(contact, contact.push);
+			m_warmStartCount++;
+		}
+	}
+
+	for (uint32_t iteration = 0; iteration < m_iterations; ++iteration)
+	{
+		for (auto& contact : m_contacts)
+		{
+			const auto& a = bodies[contact.bodyA];
+			const auto& b = bodies[contact.bodyB];
+			auto weight = a.inverseMass + b.inverseMass;
+			if (weight <= 0.0f)
+			{
+				continue;
+			}
+
+			// the normal is kept from the start of the step, what is left of
+			// the penetration is what the bodies haven't moved apart along it
+			const auto& startA = m_start[contact.bodyA];
+			const auto& startB = m_start[contact.bodyB];
+			auto apartX = (b.x - startB.x) - (a.x - startA.x);
+			auto apartY = (b.y - startB.y) - (a.y - startA.y);
+			auto left = contact.penetration - (apartX * contact.normalX + apartY * contact.normalY);
+
+			auto push = std::max(contact.push + left / weight, 0.0f);
+			applyPush(contact, push - contact.push);
+			contact.push = push;
+		}
+	}
+
+	m_lastPushes.clear();
+	for (const auto& contact : m_contacts)
+	{
+		m_lastPushes.push_back(std::make_pair(pairKey(contact), contact.push));
+	}
+}
+
+const std::vector<ContactSolver::Contact>& ContactSolver::getContacts() const
+{
+	return m_contacts;
+}
+
+size_t ContactSolver::getWarmStartCount() const
+{
+	return m_warmStartCount;
+}
+
+void ContactSolver::clear()
+{
+	m_contacts.clear();
+	m_lastPushes.clear();
+	m_start.clear();
+	m_warmStartCount = 0;
+}
+
+uint64_t ContactSolver::pairKey(const Contact& contact)
+{
+	return (static_cast<uint64_t>(contact.bodyA) << 32) | contact.bodyB;
+}
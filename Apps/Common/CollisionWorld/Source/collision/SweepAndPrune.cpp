@@ -0,0 +1,274 @@
+#include "collision/SweepAndPrune.h"
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+
+SweepAndPrune::SweepAndPrune()
+	: m_freeProxy(-1)
+	, m_pairCount(0)
+	, m_swapCount(0)
+{
+}
+
+SweepAndPrune::Handle SweepAndPrune::add(float minX, float minY, float maxX, float maxY, int32_t userData, uint32_t category, uint32_t mask)
+{
+	Handle handle;
+	if (m_freeProxy != -1)
+	{
+		handle = m_freeProxy;
+		m_freeProxy = m_proxies[handle].next;
+	}
+	else
+	{
+		handle = static_cast<Handle>(m_proxies.size());
+		m_proxies.push_back(Proxy());
+	}
+
+	// enter behind everything, the first update sorts the endpoints in
+	const auto infinity = std::numeric_limits<float>::infinity();
+	auto& proxy = m_proxies[handle];
+	proxy.userData = userData;
+	proxy.category = category;
+	proxy.mask = mask;
+	proxy.next = -1;
+	for (uint32_t axis = 0; axis < 2; ++axis)
+	{
+		auto& endpoints = this->m_endpoints[axis];
+		proxy.min[axis] = infinity;
+		proxy.max[axis] = infinity;
+		proxy.minIndex[axis] = static_cast<uint32_t>(endpoints.size());
+		proxy.maxIndex[axis] = static_cast<uint32_t>(endpoints.size() + 1);
+		endpoints.push_back({ infinity, static_cast<uint32_t>(handle) << 1 });
+		endpoints.push_back({ infinity, (static_cast<uint32_t>(handle) << 1) | 1 });
+	}
+	this->setBounds(handle, minX, minY, maxX, maxY);
+	return handle;
+}
+
+void SweepAndPrune::update(Handle handle, float minX, float minY, float maxX, float maxY)
+{
+	this->setBounds(handle, minX, minY, maxX, maxY);
+}
+
+void SweepAndPrune::remove(Handle handle)
+{
+	// leaving for infinity passes every other box and ends its pairs
+	const auto infinity = std::numeric_limits<float>::infinity();
+	this->setBounds(handle, infinity, infinity, infinity, infinity);
+	for (uint32_t axis = 0; axis < 2; ++axis)
+	{
+		auto& endpoints = this->m_endpoints[axis];
+		assert(endpoints.back().data >> 1 == static_cast<uint32_t>(handle));
+		endpoints.pop_back();
+		endpoints.pop_back();
+	}
+	m_proxies[handle].category = 0;
+	m_proxies[handle].mask = 0;
+	m_removed.push_back(handle);
+}
+
+int32_t SweepAndPrune::getUserData(Handle handle) const
+{
+	return m_proxies[handle].userData;
+}
+
+void SweepAndPrune::collectEvents(std::vector<Pair>& begun, std::vector<Pair>& ended)
+{
+	for (auto key : m_touched)
+	{
+		auto it = m_pairs.find(key);
+		auto flags = it->second;
+		Pair pair = { static_cast<Handle>(key >> 32), static_cast<Handle>(key & 0xffffffffu) };
+		if ((flags & PairCurrent) && !(flags & PairBefore))
+		{
+			begun.push_back(pair);
+		}
+		else if (!(flags & PairCurrent) && (flags & PairBefore))
+		{
+			ended.push_back(pair);
+		}
+
+		if (flags & PairCurrent)
+		{
+			it->second = PairCurrent;
+		}
+		else
+		{
+			m_pairs.erase(it);
+		}
+	}
+	m_touched.clear();
+	m_swapCount = 0;
+
+	// nobody can be told about the removed handles any more
+	for (auto handle : m_removed)
+	{
+		m_proxies[handle].next = m_freeProxy;
+		m_freeProxy = handle;
+	}
+	m_removed.clear();
+}
+
+void SweepAndPrune::getPairs(std::vector<Pair>& pairs) const
+{
+	for (const auto& entry : m_pairs)
+	{
+		if (entry.second & PairCurrent)
+		{
+			pairs.push_back({ static_cast<Handle>(entry.first >> 32), static_cast<Handle>(entry.first & 0xffffffffu) });
+		}
+	}
+}
+
+size_t SweepAndPrune::getPairCount() const
+{
+	return m_pairCount;
+}
+
+size_t SweepAndPrune::getSwapCount() const
+{
+	return m_swapCount;
+}
+
+void SweepAndPrune::clear()
+{
+	m_endpoints[0].clear();
+	m_endpoints[1].clear();
+	m_proxies.clear();
+	m_freeProxy = -1;
+	m_removed.clear();
+	m_pairs.clear();
+	m_touched.clear();
+	m_pairCount = 0;
+	m_swapCount = 0;
+}
+
+void SweepAndPrune::setBounds(Handle handle, float minX, float minY, float maxX, float maxY)
+{
+	assert(std::isfinite(minX + minY + maxX + maxY) || (minX == maxX && minY == maxY));
+	auto& proxy = m_proxies[handle];
+	const float mins[2] = { minX, minY };
+	const float maxs[2] = { maxX, maxY };
+	for (uint32_t axis = 0; axis < 2; ++axis)
+	{
+		// the box is up to date before any endpoint moves, every swap tests
+		// against its final bounds
+		proxy.min[axis] = mins[axis];
+		proxy.max[axis] = maxs[axis];
+	}
+
+	for (uint32_t axis = 0; axis < 2; ++axis)
+	{
+		auto& endpoints = this->m_endpoints[axis];
+		auto minIndex = proxy.minIndex[axis];
+		auto maxIndex = proxy.maxIndex[axis];
+		auto movesDown = mins[axis] < endpoints[minIndex].value;
+		endpoints[minIndex].value = mins[axis];
+		endpoints[maxIndex].value = maxs[axis];
+
+		// the endpoint in front goes first so the two never cross
+		if (movesDown)
+		{
+			this->moveEndpoint(axis, proxy.minIndex[axis]);
+			this->moveEndpoint(axis, proxy.maxIndex[axis]);
+		}
+		else
+		{
+			this->moveEndpoint(axis, proxy.maxIndex[axis]);
+			this->moveEndpoint(axis, proxy.minIndex[axis]);
+		}
+	}
+}
+
+void SweepAndPrune::moveEndpoint(uint32_t axis, uint32_t index)
+{
+	auto& endpoints = this->m_endpoints[axis];
+	while (index > 0 && less(endpoints[index], endpoints[index - 1]))
+	{
+		this->swapEndpoints(axis, index, index - 1);
+		index--;
+	}
+	while (index + 1 < endpoints.size() && less(endpoints[index + 1], endpoints[index]))
+	{
+		this->swapEndpoints(axis, index, index + 1);
+		index++;
+	}
+}
+
+void SweepAndPrune::swapEndpoints(uint32_t axis, uint32_t index, uint32_t other)
+{
+	auto& endpoints = this->m_endpoints[axis];
+	std::swap(endpoints[index], endpoints[other]);
+	m_swapCount++;
+
+	const auto& moved = endpoints[other];
+	const auto& passed = endpoints[index];
+	auto movedProxy = static_cast<Handle>(moved.data >> 1);
+	auto passedProxy = static_cast<Handle>(passed.data >> 1);
+	((moved.data & 1) ? m_proxies[movedProxy].maxIndex : m_proxies[movedProxy].minIndex)[axis] = other;
+	((passed.data & 1) ? m_proxies[passedProxy].maxIndex : m_proxies[passedProxy].minIndex)[axis] = index;
+
+	// only a min passing a max changes whether the two overlap
+	if ((moved.data & 1) == (passed.data & 1) || movedProxy == passedProxy)
+	{
+		return;
+	}
+	const auto& a = m_proxies[movedProxy];
+	const auto& b = m_proxies[passedProxy];
+	auto overlapping = a.min[0] <= b.max[0] && b.min[0] <= a.max[0] && a.min[1] <= b.max[1] && b.min[1] <= a.max[1];
+	this->setPair(movedProxy, passedProxy, overlapping);
+}
+
+void SweepAndPrune::setPair(Handle a, Handle b, bool overlapping)
+{
+	if (!(m_proxies[a].category & m_proxies[b].mask) || !(m_proxies[b].category & m_proxies[a].mask))
+	{
+		return;
+	}
+
+	auto key = pairKey(a, b);
+	auto it = m_pairs.find(key);
+	auto current = it != m_pairs.end() && (it->second & PairCurrent);
+	if (current == overlapping)
+	{
+		return;
+	}
+	if (it == m_pairs.end())
+	{
+		it = m_pairs.insert(std::make_pair(key, 0u)).first;
+	}
+
+	// remember the state of the last collectEvents on the first change
+	auto& flags = it->second;
+	if (!(flags & PairTouched))
+	{
+		flags |= PairTouched | (current ? static_cast<uint32_t>(PairBefore) : 0u);
+		m_touched.push_back(key);
+	}
+	flags = overlapping ? (flags | PairCurrent) : (flags & ~PairCurrent);
+	if (overlapping)
+	{
+		m_pairCount++;
+	}
+	else
+	{
+		m_pairCount--;
+	}
+}
+
+bool SweepAndPrune::less(const Endpoint& a, const Endpoint& b)
+{
+	// mins go first on ties so touching boxes overlap
+	return a.value < b.value || (a.value == b.value && (a.data & 1) < (b.data & 1));
+}
+
+uint64_t SweepAndPrune::pairKey(Handle a, Handle b)
+{
+	if (a > b)
+	{
+		std::swap(a, b);
+	}
+	return (static_cast<uint64_t>(a) << 32) | static_cast<uint32_t>(b);
+}
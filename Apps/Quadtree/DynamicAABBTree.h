@@ -0,0 +1,538 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "imgui.h"
+
+#include "Quadtree.h"
+
+// Bounding volume hierarchy over moving objects. Every leaf holds one object
+// with its bounds fattened by a margin and stretched along its last move, so
+// an object only has to leave the tree and go back in once it leaves that
+// fat box. A new leaf descends towards the sibling that grows the summed box
+// perimeters the least (the 2D surface area heuristic), and the nodes on its
+// way back up are rotated whenever the heights of their children drift more
+// than one apart.
+//
+// Objects with non-finite bounds get an infinite fat box, every query visits
+// them.
+template<typename T>
+class DynamicAABBTree
+{
+public:
+
+	typedef int32_t Handle;
+
+	explicit DynamicAABBTree(float margin = 8.0f)
+		: m_margin(std::max(0.0f, margin))
+		, m_root(-1)
+		, m_freeNode(-1)
+		, m_leafCount(0)
+	{
+	}
+
+	Handle insert(const QuadRect& rect, const T& data)
+	{
+		auto leaf = allocNode();
+		auto& node = m_nodes[leaf];
+		node.bounds = rect;
+		node.data = data;
+		node.fat = fatten(rect, 0.0f, 0.0f);
+		node.height = 0;
+		insertLeaf(leaf);
+		m_leafCount++;
+		return leaf;
+	}
+
+	void remove(Handle handle)
+	{
+		removeLeaf(handle);
+		freeNode(handle);
+		m_leafCount--;
+	}
+
+	// Moves the object and returns true if it had to be put back into the
+	// tree, i.e. it left its fat box or the box grew far too large for it.
+	bool update(Handle handle, const QuadRect& rect)
+	{
+		auto dx = rect.x - m_nodes[handle].bounds.x;
+		auto dy = rect.y - m_nodes[handle].bounds.y;
+		m_nodes[handle].bounds = rect;
+
+		auto fat = fatten(rect, dx, dy);
+		const auto& current = m_nodes[handle].fat;
+		if (containsBox(current, toBox(rect)) && containsBox(expandBox(fat, 4.0f * m_margin), current))
+		{
+			return false;
+		}
+
+		removeLeaf(handle);
+		m_nodes[handle].fat = fat;
+		insertLeaf(handle);
+		return true;
+	}
+
+	const QuadRect& getBounds(Handle handle) const
+	{
+		return m_nodes[handle].bounds;
+	}
+
+	QuadRect getFatBounds(Handle handle) const
+	{
+		const auto& fat = m_nodes[handle].fat;
+		return QuadRect(fat.minX, fat.minY, fat.maxX - fat.minX, fat.maxY - fat.minY);
+	}
+
+	void retrieve(const QuadRect& rect, std::vector<T>& returnObjects) const
+	{
+		retrieve(rect, [&returnObjects](const T& data)
+		{
+			returnObjects.push_back(data);
+		});
+	}
+
+	// Calls visitor(const T&) for every object whose fat box touches the rect.
+	template<typename Visitor>
+	void retrieve(const QuadRect& rect, Visitor&& visitor) const
+	{
+		if (m_root != -1)
+		{
+			visitNode(m_root, toBox(rect), rect, false, visitor);
+		}
+	}
+
+	// Calls visitor(const T&) for every object whose bounds overlap rect,
+	// touching edges count as overlap.
+	template<typename Visitor>
+	void query(const QuadRect& rect, Visitor&& visitor) const
+	{
+		if (m_root != -1)
+		{
+			visitNode(m_root, toBox(rect), rect, true, visitor);
+		}
+	}
+
+	// Calls visitor(const T&, const T&) once for every pair of objects whose
+	// bounds overlap. The tree is tested against itself, subtrees whose fat
+	// boxes are apart are never opened.
+	template<typename Visitor>
+	void queryPairs(Visitor&& visitor) const
+	{
+		if (m_root != -1)
+		{
+			selfPairs(m_root, visitor);
+		}
+	}
+
+	void clear()
+	{
+		m_nodes.clear();
+		m_root = -1;
+		m_freeNode = -1;
+		m_leafCount = 0;
+	}
+
+	uint32_t getHeight() const
+	{
+		return m_root != -1 ? static_cast<uint32_t>(m_nodes[m_root].height) : 0;
+	}
+
+	QuadtreeStats getStats() const
+	{
+		QuadtreeStats stats = {};
+		stats.leafCount = m_leafCount;
+		stats.nodeCount = m_leafCount > 0 ? m_leafCount * 2 - 1 : 0;
+		stats.maxDepth = getHeight();
+		stats.maxLeafOccupancy = m_leafCount > 0 ? 1 : 0;
+		stats.objectCount = m_leafCount;
+		stats.linkCount = m_leafCount;
+		return stats;
+	}
+
+	// draws the fat boxes, the ones of inner nodes dimmed
+	void debugDraw(ImDrawList* draw_list, ImVec2 canvas_pos) const
+	{
+		for (const auto& node : m_nodes)
+		{
+			if (node.height < 0 || !std::isfinite(node.fat.minX + node.fat.minY + node.fat.maxX + node.fat.maxY))
+			{
+				continue;
+			}
+			draw_list->AddRect(ImVec2(node.fat.minX + canvas_pos.x, node.fat.minY + canvas_pos.y),
+				ImVec2(node.fat.maxX + canvas_pos.x, node.fat.maxY + canvas_pos.y),
+				node.height == 0 ? IM_COL32(120, 220, 120, 255) : IM_COL32(120, 220, 120, 70));
+		}
+	}
+
+private:
+
+	// fat boxes are stretched by this many times the last move
+	enum : uint32_t { PredictionFactor = 2 };
+
+	struct Box
+	{
+		float minX;
+		float minY;
+		float maxX;
+		float maxY;
+	};
+
+	struct Node
+	{
+		Box fat;
+		// the object's own bounds, leaves only
+		QuadRect bounds;
+		T data;
+		// parent, next free node while unused
+		int32_t parent;
+		int32_t child1;
+		int32_t child2;
+		// 0 for leaves, -1 while unused
+		int32_t height;
+
+		bool isLeaf() const
+		{
+			return child1 == -1;
+		}
+	};
+
+	int32_t allocNode()
+	{
+		int32_t index;
+		if (m_freeNode != -1)
+		{
+			index = m_freeNode;
+			m_freeNode = m_nodes[index].parent;
+		}
+		else
+		{
+			index = static_cast<int32_t>(m_nodes.size());
+			m_nodes.push_back(Node());
+		}
+		auto& node = m_nodes[index];
+		node.parent = -1;
+		node.child1 = -1;
+		node.child2 = -1;
+		node.height = 0;
+		return index;
+	}
+
+	void freeNode(int32_t index)
+	{
+		auto& node = m_nodes[index];
+		node.data = T();
+		node.height = -1;
+		node.parent = m_freeNode;
+		m_freeNode = index;
+	}
+
+	void insertLeaf(int32_t leaf)
+	{
+		if (m_root == -1)
+		{
+			m_root = leaf;
+			m_nodes[leaf].parent = -1;
+			return;
+		}
+
+		// Descend while splitting a child is cheaper than pairing the leaf
+		// with the current node. Every node above the new one grows by the
+		// leaf's box, which the children inherit as a cost.
+		auto box = m_nodes[leaf].fat;
+		auto index = m_root;
+		while (!m_nodes[index].isLeaf())
+		{
+			const auto& node = m_nodes[index];
+			auto combined = perimeter(combineBox(node.fat, box));
+			auto cost = 2.0f * combined;
+			auto inheritance = 2.0f * (combined - perimeter(node.fat));
+
+			auto cost1 = descendCost(node.child1, box) + inheritance;
+			auto cost2 = descendCost(node.child2, box) + inheritance;
+			if (cost < cost1 && cost < cost2)
+			{
+				break;
+			}
+			index = cost1 < cost2 ? node.child1 : node.child2;
+		}
+
+		auto sibling = index;
+		auto oldParent = m_nodes[sibling].parent;
+		auto newParent = allocNode();
+		m_nodes[newParent].parent = oldParent;
+		m_nodes[newParent].fat = combineBox(box, m_nodes[sibling].fat);
+		m_nodes[newParent].height = m_nodes[sibling].height + 1;
+		m_nodes[newParent].child1 = sibling;
+		m_nodes[newParent].child2 = leaf;
+		m_nodes[sibling].parent = newParent;
+		m_nodes[leaf].parent = newParent;
+		if (oldParent == -1)
+		{
+			m_root = newParent;
+		}
+		else if (m_nodes[oldParent].child1 == sibling)
+		{
+			m_nodes[oldParent].child1 = newParent;
+		}
+		else
+		{
+			m_nodes[oldParent].child2 = newParent;
+		}
+
+		refitFrom(m_nodes[leaf].parent);
+	}
+
+	// perimeter the subtree of index adds when the box joins it
+	float descendCost(int32_t index, const Box& box) const
+	{
+		const auto& node = m_nodes[index];
+		if (node.isLeaf())
+		{
+			return perimeter(combineBox(box, node.fat));
+		}
+		return perimeter(combineBox(box, node.fat)) - perimeter(node.fat);
+	}
+
+	void removeLeaf(int32_t leaf)
+	{
+		if (leaf == m_root)
+		{
+			m_root = -1;
+			return;
+		}
+
+		auto parent = m_nodes[leaf].parent;
+		auto grandParent = m_nodes[parent].parent;
+		auto sibling = m_nodes[parent].child1 == leaf ? m_nodes[parent].child2 : m_nodes[parent].child1;
+
+		// the sibling takes the parent's place
+		m_nodes[sibling].parent = grandParent;
+		freeNode(parent);
+		if (grandParent == -1)
+		{
+			m_root = sibling;
+			return;
+		}
+		if (m_nodes[grandParent].child1 == parent)
+		{
+			m_nodes[grandParent].child1 = sibling;
+		}
+		else
+		{
+			m_nodes[grandParent].child2 = sibling;
+		}
+		refitFrom(grandParent);
+	}
+
+	// rebalances and refits the nodes from index up to the root
+	void refitFrom(int32_t index)
+	{
+		while (index != -1)
+		{
+			index = balance(index);
+			auto& node = m_nodes[index];
+			const auto& child1 = m_nodes[node.child1];
+			const auto& child2 = m_nodes[node.child2];
+			node.height = 1 + std::max(child1.height, child2.height);
+			node.fat = combineBox(child1.fat, child2.fat);
+			index = node.parent;
+		}
+	}
+
+	// Lifts the higher grandchild into a's place if the heights of a's
+	// children differ by more than one, returns the node now in that place.
+	int32_t balance(int32_t a)
+	{
+		if (m_nodes[a].isLeaf() || m_nodes[a].height < 2)
+		{
+			return a;
+		}
+
+		auto b = m_nodes[a].child1;
+		auto c = m_nodes[a].child2;
+		auto difference = m_nodes[c].height - m_nodes[b].height;
+		if (difference > 1)
+		{
+			rotate(a, c, b, false);
+			return c;
+		}
+		if (difference < -1)
+		{
+			rotate(a, b, c, true);
+			return b;
+		}
+		return a;
+	}
+
+	// Moves up into a's place, a takes up's lower child next to other and up
+	// keeps its higher child. upIsChild1 tells which child of a up was.
+	void rotate(int32_t a, int32_t up, int32_t other, bool upIsChild1)
+	{
+		auto f = m_nodes[up].child1;
+		auto g = m_nodes[up].child2;
+
+		m_nodes[up].child1 = a;
+		m_nodes[up].parent = m_nodes[a].parent;
+		m_nodes[a].parent = up;
+		auto parent = m_nodes[up].parent;
+		if (parent == -1)
+		{
+			m_root = up;
+		}
+		else if (m_nodes[parent].child1 == a)
+		{
+			m_nodes[parent].child1 = up;
+		}
+		else
+		{
+			m_nodes[parent].child2 = up;
+		}
+
+		auto keep = m_nodes[f].height > m_nodes[g].height ? f : g;
+		auto give = keep == f ? g : f;
+		m_nodes[up].child2 = keep;
+		if (upIsChild1)
+		{
+			m_nodes[a].child1 = give;
+		}
+		else
+		{
+			m_nodes[a].child2 = give;
+		}
+		m_nodes[give].parent = a;
+
+		m_nodes[a].fat = combineBox(m_nodes[other].fat, m_nodes[give].fat);
+		m_nodes[a].height = 1 + std::max(m_nodes[other].height, m_nodes[give].height);
+		m_nodes[up].fat = combineBox(m_nodes[a].fat, m_nodes[keep].fat);
+		m_nodes[up].height = 1 + std::max(m_nodes[a].height, m_nodes[keep].height);
+	}
+
+	template<typename Visitor>
+	void visitNode(int32_t index, const Box& box, const QuadRect& rect, bool exact, Visitor& visitor) const
+	{
+		const auto& node = m_nodes[index];
+		if (!overlapsBox(node.fat, box))
+		{
+			return;
+		}
+		if (node.isLeaf())
+		{
+			if (!exact || overlapsRect(node.bounds, rect))
+			{
+				visitor(node.data);
+			}
+			return;
+		}
+		visitNode(node.child1, box, rect, exact, visitor);
+		visitNode(node.child2, box, rect, exact, visitor);
+	}
+
+	template<typename Visitor>
+	void selfPairs(int32_t index, Visitor& visitor) const
+	{
+		const auto& node = m_nodes[index];
+		if (node.isLeaf())
+		{
+			return;
+		}
+		selfPairs(node.child1, visitor);
+		selfPairs(node.child2, visitor);
+		crossPairs(node.child1, node.child2, visitor);
+	}
+
+	// pairs with one object below a and one below b
+	template<typename Visitor>
+	void crossPairs(int32_t a, int32_t b, Visitor& visitor) const
+	{
+		const auto& nodeA = m_nodes[a];
+		const auto& nodeB = m_nodes[b];
+		if (!overlapsBox(nodeA.fat, nodeB.fat))
+		{
+			return;
+		}
+		if (nodeA.isLeaf() && nodeB.isLeaf())
+		{
+			if (overlapsRect(nodeA.bounds, nodeB.bounds))
+			{
+				visitor(nodeA.data, nodeB.data);
+			}
+			return;
+		}
+
+		// open the larger node first
+		if (nodeB.isLeaf() || (!nodeA.isLeaf() && perimeter(nodeA.fat) >= perimeter(nodeB.fat)))
+		{
+			crossPairs(nodeA.child1, b, visitor);
+			crossPairs(nodeA.child2, b, visitor);
+		}
+		else
+		{
+			crossPairs(a, nodeB.child1, visitor);
+			crossPairs(a, nodeB.child2, visitor);
+		}
+	}
+
+	Box fatten(const QuadRect& rect, float dx, float dy) const
+	{
+		if (!(std::isfinite(rect.x) && std::isfinite(rect.y) && std::isfinite(rect.width) && std::isfinite(rect.height)))
+		{
+			const auto infinity = std::numeric_limits<float>::infinity();
+			return { -infinity, -infinity, infinity, infinity };
+		}
+
+		auto box = expandBox(toBox(rect), m_margin);
+		dx *= PredictionFactor;
+		dy *= PredictionFactor;
+		(dx < 0.0f ? box.minX : box.maxX) += dx;
+		(dy < 0.0f ? box.minY : box.maxY) += dy;
+		return box;
+	}
+
+	static Box toBox(const QuadRect& rect)
+	{
+		return { rect.x, rect.y, rect.x + rect.width, rect.y + rect.height };
+	}
+
+	static Box expandBox(const Box& box, float margin)
+	{
+		return { box.minX - margin, box.minY - margin, box.maxX + margin, box.maxY + margin };
+	}
+
+	static Box combineBox(const Box& a, const Box& b)
+	{
+		return { std::min(a.minX, b.minX), std::min(a.minY, b.minY), std::max(a.maxX, b.maxX), std::max(a.maxY, b.maxY) };
+	}
+
+	static float perimeter(const Box& box)
+	{
+		return 2.0f * ((box.maxX - box.minX) + (box.maxY - box.minY));
+	}
+
+	static bool containsBox(const Box& outer, const Box& inner)
+	{
+		return outer.minX <= inner.minX && outer.minY <= inner.minY && inner.maxX <= outer.maxX && inner.maxY <= outer.maxY;
+	}
+
+	static bool overlapsBox(const Box& a, const Box& b)
+	{
+		return !(a.maxX < b.minX || b.maxX < a.minX || a.maxY < b.minY || b.maxY < a.minY);
+	}
+
+	// same as overlapsBox so NaN bounds behave the same
+	static bool overlapsRect(const QuadRect& a, const QuadRect& b)
+	{
+		return !(a.x + a.width < b.x || b.x + b.width < a.x ||
+			a.y + a.height < b.y || b.y + b.height < a.y);
+	}
+
+private:
+	float m_margin;
+	std::vector<Node> m_nodes;
+	int32_t m_root;
+	int32_t m_freeNode;
+	uint32_t m_leafCount;
+};
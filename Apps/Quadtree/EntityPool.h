@@ -0,0 +1,178 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+// 32-bit reference to an object of an EntityPool, trivially copyable so it
+// is a cheap tree payload. The default value 0 never refers to anything.
+struct EntityHandle
+{
+	uint32_t value;
+
+	bool operator==(const EntityHandle& other) const
+	{
+		return value == other.value;
+	}
+
+	bool operator!=(const EntityHandle& other) const
+	{
+		return value != other.value;
+	}
+
+	bool operator<(const EntityHandle& other) const
+	{
+		return value < other.value;
+	}
+};
+
+// Keeps its objects in one dense array, destroy moves the last one into the
+// hole. A handle names a slot in its low IndexBits and the slot's generation
+// above them; the generation changes whenever the slot is freed, so a handle
+// to a destroyed object is detected instead of reaching its successor.
+template<typename T>
+class EntityPool
+{
+public:
+
+	enum : uint32_t { IndexBits = 20 };
+	enum : uint32_t { IndexMask = (1u << IndexBits) - 1 };
+	enum : uint32_t { GenerationMask = (1u << (32 - IndexBits)) - 1 };
+
+	EntityPool()
+		: m_freeSlot(IndexMask)
+	{
+	}
+
+	EntityHandle create(const T& value)
+	{
+		uint32_t slot;
+		if (m_freeSlot != IndexMask)
+		{
+			slot = m_freeSlot;
+			m_freeSlot = m_slotItem[slot];
+		}
+		else
+		{
+			slot = static_cast<uint32_t>(m_slotItem.size());
+			assert(slot < IndexMask);
+			m_slotItem.push_back(0);
+			m_slotGeneration.push_back(1);
+		}
+
+		m_slotItem[slot] = static_cast<uint32_t>(m_items.size());
+		m_items.push_back(value);
+		m_itemSlot.push_back(slot);
+		return makeHandle(slot);
+	}
+
+	void destroy(EntityHandle handle)
+	{
+		assert(valid(handle));
+		auto slot = handle.value & IndexMask;
+		auto item = m_slotItem[slot];
+
+		// fill the hole with the last object
+		auto last = static_cast<uint32_t>(m_items.size() - 1);
+		if (item != last)
+		{
+			m_items[item] = m_items[last];
+			m_itemSlot[item] = m_itemSlot[last];
+			m_slotItem[m_itemSlot[item]] = item;
+		}
+		m_items.pop_back();
+		m_itemSlot.pop_back();
+
+		// generation 0 is skipped so no handle ever equals the default one
+		auto generation = (m_slotGeneration[slot] + 1) & GenerationMask;
+		m_slotGeneration[slot] = generation ? generation : 1;
+		m_slotItem[slot] = m_freeSlot;
+		m_freeSlot = slot;
+	}
+
+	bool valid(EntityHandle handle) const
+	{
+		auto slot = handle.value & IndexMask;
+		// freeing a slot moves its generation past every handle given out
+		return slot < m_slotGeneration.size() && m_slotGeneration[slot] == handle.value >> IndexBits;
+	}
+
+	// null for stale handles
+	T* tryGet(EntityHandle handle)
+	{
+		return valid(handle) ? &m_items[m_slotItem[handle.value & IndexMask]] : nullptr;
+	}
+
+	const T* tryGet(EntityHandle handle) const
+	{
+		return valid(handle) ? &m_items[m_slotItem[handle.value & IndexMask]] : nullptr;
+	}
+
+	T& operator[](EntityHandle handle)
+	{
+		assert(valid(handle));
+		return m_items[m_slotItem[handle.value & IndexMask]];
+	}
+
+	const T& operator[](EntityHandle handle) const
+	{
+		assert(valid(handle));
+		return m_items[m_slotItem[handle.value & IndexMask]];
+	}
+
+	// handle of the object at a dense position
+	EntityHandle handleAt(size_t item) const
+	{
+		return makeHandle(m_itemSlot[item]);
+	}
+
+	size_t size() const
+	{
+		return m_items.size();
+	}
+
+	T* begin()
+	{
+		return m_items.data();
+	}
+
+	T* end()
+	{
+		return m_items.data() + m_items.size();
+	}
+
+	const T* begin() const
+	{
+		return m_items.data();
+	}
+
+	const T* end() const
+	{
+		return m_items.data() + m_items.size();
+	}
+
+	void clear()
+	{
+		while (!m_items.empty())
+		{
+			destroy(handleAt(m_items.size() - 1));
+		}
+	}
+
+private:
+
+	EntityHandle makeHandle(uint32_t slot) const
+	{
+		return { (m_slotGeneration[slot] << IndexBits) | slot };
+	}
+
+private:
+	// dense objects and the slot each one belongs to
+	std::vector<T> m_items;
+	std::vector<uint32_t> m_itemSlot;
+	// per slot: dense position while used, next free slot otherwise
+	std::vector<uint32_t> m_slotItem;
+	std::vector<uint32_t> m_slotGeneration;
+	uint32_t m_freeSlot;
+};
@@ -0,0 +1,660 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "imgui.h"
+
+#include "Quadtree.h"
+
+// Front of a serialized LinearQuadtree, followed by the sorted keys, the
+// directory and the entries, aligned for the entry type. All fields are in
+// native byte order.
+struct LinearQuadtreeHeader
+{
+	enum : uint32_t { Magic = 0x3154514c }; // "LQT1"
+
+	uint32_t magic;
+	// sizeof the entry, catches views opened with a payload of another size
+	uint32_t entrySize;
+	uint64_t count;
+	QuadRect bounds;
+	uint32_t depth;
+	uint32_t directoryLevel;
+};
+
+// Read-only queries over sorted LinearQuadtree entries it does not own, either
+// a tree's own array or serialized bytes, e.g. a memory-mapped file.
+template<typename T>
+class LinearQuadtreeView
+{
+public:
+
+	struct Entry
+	{
+		QuadRect bounds;
+		T data;
+	};
+
+	enum : uint32_t { LevelBits = 5 };
+
+	LinearQuadtreeView()
+		: m_keys(nullptr)
+		, m_directory(nullptr)
+		, m_entries(nullptr)
+		, m_count(0)
+		, m_depth(0)
+		, m_directoryLevel(0)
+	{
+	}
+
+	LinearQuadtreeView(const uint64_t* keys, const uint32_t* directory, const Entry* entries, size_t count, const QuadRect& bounds, uint32_t depth, uint32_t directoryLevel)
+		: m_keys(keys)
+		, m_directory(directory)
+		, m_entries(entries)
+		, m_count(count)
+		, m_bounds(bounds)
+		, m_depth(depth)
+		, m_directoryLevel(directoryLevel)
+	{
+	}
+
+	// Checks the header and size of bytes written by LinearQuadtree::serialize
+	// and views them in place, the bytes have to outlive the view and be
+	// aligned like the entries. Returns false and leaves view alone on
+	// mismatch; the keys and directory themselves are trusted.
+	static bool fromBytes(const void* data, size_t size, LinearQuadtreeView& view)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "serialized payloads have to be trivially copyable");
+
+		if (size < sizeof(LinearQuadtreeHeader))
+		{
+			return false;
+		}
+		LinearQuadtreeHeader header;
+		std::memcpy(&header, data, sizeof(header));
+		if (header.magic != LinearQuadtreeHeader::Magic || header.entrySize != sizeof(Entry) ||
+			header.depth > MaxDepth || header.directoryLevel > std::min<uint32_t>(header.depth, MaxDirectoryLevel) ||
+			header.count > (size - sizeof(header)) / (sizeof(uint64_t) + sizeof(Entry)))
+		{
+			return false;
+		}
+		auto count = static_cast<size_t>(header.count);
+		auto offset = entriesOffset(count, header.directoryLevel);
+		if (offset + count * sizeof(Entry) > size)
+		{
+			return false;
+		}
+
+		auto bytes = static_cast<const uint8_t*>(data);
+		auto keys = reinterpret_cast<const uint64_t*>(bytes + sizeof(header));
+		view = LinearQuadtreeView(keys, reinterpret_cast<const uint32_t*>(keys + count), reinterpret_cast<const Entry*>(bytes + offset),
+			count, header.bounds, header.depth, header.directoryLevel);
+		return true;
+	}
+
+	// size of the directory of a level, one start per cell plus the end
+	static size_t directorySize(uint32_t directoryLevel)
+	{
+		return (static_cast<size_t>(1) << (2 * directoryLevel)) + 1;
+	}
+
+	// where the entries start in serialized bytes
+	static size_t entriesOffset(size_t count, uint32_t directoryLevel)
+	{
+		auto offset = sizeof(LinearQuadtreeHeader) + count * sizeof(uint64_t) + directorySize(directoryLevel) * sizeof(uint32_t);
+		return (offset + alignof(Entry) - 1) / alignof(Entry) * alignof(Entry);
+	}
+
+	size_t size() const
+	{
+		return m_count;
+	}
+
+	const QuadRect& getBounds() const
+	{
+		return m_bounds;
+	}
+
+	uint32_t getDepth() const
+	{
+		return m_depth;
+	}
+
+	// cell origin morton code << LevelBits | cell level of every entry
+	const uint64_t* keys() const
+	{
+		return m_keys;
+	}
+
+	// first entry at or behind every cell of the directory level in morton
+	// order, followed by the entry count
+	const uint32_t* directory() const
+	{
+		return m_directory;
+	}
+
+	uint32_t getDirectoryLevel() const
+	{
+		return m_directoryLevel;
+	}
+
+	const Entry* entries() const
+	{
+		return m_entries;
+	}
+
+	void retrieve(const QuadRect& rect, std::vector<T>& returnObjects) const
+	{
+		retrieve(rect, [&returnObjects](const T& data)
+		{
+			returnObjects.push_back(data);
+		});
+	}
+
+	// Calls visitor(const T&) for every object of every cell the rect touches.
+	template<typename Visitor>
+	void retrieve(const QuadRect& rect, Visitor&& visitor) const
+	{
+		visitCells(rect, false, visitor);
+	}
+
+	// Calls visitor(const T&) for every object whose bounds overlap rect,
+	// touching edges count as overlap.
+	template<typename Visitor>
+	void query(const QuadRect& rect, Visitor&& visitor) const
+	{
+		visitCells(rect, true, visitor);
+	}
+
+	// cells of the finest level per axis is 2^MaxDepth
+	enum : uint32_t { MaxDepth = 16 };
+	// the directory has 4^level + 1 entries
+	enum : uint32_t { MaxDirectoryLevel = 10 };
+
+	// integer cell coordinate at the finest level, clamped to the grid
+	uint32_t quantizeX(float x) const
+	{
+		return quantize(x - m_bounds.x, m_bounds.width);
+	}
+
+	uint32_t quantizeY(float y) const
+	{
+		return quantize(y - m_bounds.y, m_bounds.height);
+	}
+
+	static uint32_t interleave(uint32_t x, uint32_t y)
+	{
+		return spreadBits(x) | (spreadBits(y) << 1);
+	}
+
+private:
+
+	enum : uint32_t { ScanLimit = 16 };
+
+	// finest level cells covered by a query, inclusive
+	struct CellRange
+	{
+		uint32_t minX;
+		uint32_t minY;
+		uint32_t maxX;
+		uint32_t maxY;
+	};
+
+	uint32_t quantize(float offset, float size) const
+	{
+		auto cells = 1u << m_depth;
+		auto scaled = offset / size * cells;
+		// written so NaN lands on 0
+		if (!(scaled > 0.0f))
+		{
+			return 0;
+		}
+		if (scaled >= static_cast<float>(cells))
+		{
+			return cells - 1;
+		}
+		return static_cast<uint32_t>(scaled);
+	}
+
+	static uint32_t spreadBits(uint32_t value)
+	{
+		value &= 0xffff;
+		value = (value | (value << 8)) & 0x00ff00ff;
+		value = (value | (value << 4)) & 0x0f0f0f0f;
+		value = (value | (value << 2)) & 0x33333333;
+		value = (value | (value << 1)) & 0x55555555;
+		return value;
+	}
+
+	// first entry of begin..end at or behind the cell at level with that
+	// full depth origin code
+	size_t cellStart(uint32_t level, uint32_t origin, size_t begin, size_t end) const
+	{
+		// the upper levels are looked up, binary searches there would cross
+		// most of the array
+		if (level <= m_directoryLevel)
+		{
+			return m_directory[origin >> (2 * (m_depth - m_directoryLevel))];
+		}
+		auto key = static_cast<uint64_t>(origin) << LevelBits;
+		return static_cast<size_t>(std::lower_bound(m_keys + begin, m_keys + end, key) - m_keys);
+	}
+
+	template<typename Visitor>
+	void visitCells(const QuadRect& rect, bool exact, Visitor& visitor) const
+	{
+		if (m_count == 0)
+		{
+			return;
+		}
+		CellRange range = { quantizeX(rect.x), quantizeY(rect.y), quantizeX(rect.x + rect.width), quantizeY(rect.y + rect.height) };
+		visitCell(0, 0, 0, 0, m_count, rect, range, exact, visitor);
+	}
+
+	// begin..end holds the cell (level, x, y) and everything below it
+	template<typename Visitor>
+	void visitCell(uint32_t level, uint32_t x, uint32_t y, size_t begin, size_t end, const QuadRect& rect, const CellRange& range, bool exact, Visitor& visitor) const
+	{
+		auto shift = m_depth - level;
+		auto origin = static_cast<uint64_t>(interleave(x << shift, y << shift)) << LevelBits;
+
+		// the objects of the cell itself come first
+		auto own = origin | level;
+		auto first = begin;
+		for (; first < end && m_keys[first] == own; ++first)
+		{
+			const auto& entry = m_entries[first];
+			if (!exact || overlapsRect(entry.bounds, rect))
+			{
+				visitor(entry.data);
+			}
+		}
+
+		if (level == m_depth || first == end)
+		{
+			return;
+		}
+
+		// descending costs three binary searches per cell, a few objects are
+		// cheaper to test one by one
+		if (end - first <= ScanLimit)
+		{
+			for (; first < end; ++first)
+			{
+				const auto& entry = m_entries[first];
+				if (!exact || overlapsRect(entry.bounds, rect))
+				{
+					visitor(entry.data);
+				}
+			}
+			return;
+		}
+
+		// the children are contiguous ranges in morton order
+		size_t bounds[5];
+		bounds[0] = first;
+		bounds[4] = end;
+		auto childShift = shift - 1;
+		for (uint32_t digit = 1; digit < 4; ++digit)
+		{
+			auto childX = (x << 1) | (digit & 1);
+			auto childY = (y << 1) | (digit >> 1);
+			bounds[digit] = cellStart(level + 1, interleave(childX << childShift, childY << childShift), bounds[digit - 1], end);
+		}
+
+		for (uint32_t digit = 0; digit < 4; ++digit)
+		{
+			if (bounds[digit] == bounds[digit + 1])
+			{
+				continue;
+			}
+			auto childX = (x << 1) | (digit & 1);
+			auto childY = (y << 1) | (digit >> 1);
+			auto minX = childX << childShift;
+			auto minY = childY << childShift;
+			auto maxX = minX + (1u << childShift) - 1;
+			auto maxY = minY + (1u << childShift) - 1;
+			if (maxX < range.minX || minX > range.maxX || maxY < range.minY || minY > range.maxY)
+			{
+				continue;
+			}
+
+			// quantizing keeps the order, an object in a cell strictly inside
+			// the range lies inside rect
+			if (exact && range.minX < minX && maxX < range.maxX && range.minY < minY && maxY < range.maxY)
+			{
+				for (auto i = bounds[digit]; i < bounds[digit + 1]; ++i)
+				{
+					visitor(m_entries[i].data);
+				}
+				continue;
+			}
+			visitCell(level + 1, childX, childY, bounds[digit], bounds[digit + 1], rect, range, exact, visitor);
+		}
+	}
+
+	static bool overlapsRect(const QuadRect& a, const QuadRect& b)
+	{
+		return !(a.x + a.width < b.x || b.x + b.width < a.x ||
+			a.y + a.height < b.y || b.y + b.height < a.y);
+	}
+
+private:
+	// kept apart from the entries so the binary searches touch less memory
+	const uint64_t* m_keys;
+	const uint32_t* m_directory;
+	const Entry* m_entries;
+	size_t m_count;
+	QuadRect m_bounds;
+	uint32_t m_depth;
+	uint32_t m_directoryLevel;
+};
+
+// Pointerless quadtree: every object is keyed by the morton code of the
+// deepest cell that fully contains it plus that cell's level, and all objects
+// sit in one array sorted by key. The objects below any cell form one
+// contiguous range, so queries walk the implicit cells and find the ranges of
+// the children, skipping empty ones. A directory holds the range start of
+// every cell down to a level picked from the object count, below it the
+// ranges are small and found by binary search over the keys.
+//
+// Meant for static geometry: build sorts everything once. insert and remove
+// keep the array sorted and move every entry behind the object, fine for a
+// few edits but not for per-frame updates of many objects. Objects reaching
+// outside the bounds are kept with the root. With a trivially copyable T the
+// array can be written with serialize and queried straight from the bytes,
+// e.g. a memory-mapped file, through LinearQuadtreeView::fromBytes.
+template<typename T>
+class LinearQuadtree
+{
+public:
+
+	typedef LinearQuadtreeView<T> View;
+	typedef typename View::Entry Entry;
+
+	LinearQuadtree(QuadRect bounds, uint32_t depth = View::MaxDepth)
+		: m_bounds(bounds)
+		, m_depth(std::max(1u, std::min(depth, static_cast<uint32_t>(View::MaxDepth))))
+		, m_directoryLevel(0)
+	{
+		buildDirectory();
+	}
+
+	void insert(const QuadRect& rect, const T& data)
+	{
+		auto key = makeKey(rect);
+		auto position = std::upper_bound(m_keys.begin(), m_keys.end(), key) - m_keys.begin();
+		m_keys.insert(m_keys.begin() + position, key);
+		m_entries.insert(m_entries.begin() + position, Entry{ rect, data });
+		updateDirectory(key, 1);
+	}
+
+	// Removes one object inserted with that rect and an equal data, false if
+	// there is none.
+	bool remove(const QuadRect& rect, const T& data)
+	{
+		auto key = makeKey(rect);
+		auto range = std::equal_range(m_keys.begin(), m_keys.end(), key);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			auto position = it - m_keys.begin();
+			const auto& entry = m_entries[position];
+			if (entry.data == data && std::memcmp(&entry.bounds, &rect, sizeof(rect)) == 0)
+			{
+				m_keys.erase(it);
+				m_entries.erase(m_entries.begin() + position);
+				updateDirectory(key, -1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Replaces the contents with items, sorted once.
+	void build(const std::pair<QuadRect, T>* items, size_t count)
+	{
+		m_buildOrder.clear();
+		m_buildOrder.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_buildOrder.push_back({ makeKey(items[i].first), static_cast<uint32_t>(i) });
+		}
+		std::sort(m_buildOrder.begin(), m_buildOrder.end());
+
+		m_keys.clear();
+		m_entries.clear();
+		m_keys.reserve(count);
+		m_entries.reserve(count);
+		for (const auto& entry : m_buildOrder)
+		{
+			m_keys.push_back(entry.first);
+			m_entries.push_back({ items[entry.second].first, items[entry.second].second });
+		}
+		buildDirectory();
+	}
+
+	void build(const std::vector<std::pair<QuadRect, T>>& items)
+	{
+		build(items.data(), items.size());
+	}
+
+	void retrieve(const QuadRect& rect, std::vector<T>& returnObjects) const
+	{
+		view().retrieve(rect, returnObjects);
+	}
+
+	// Calls visitor(const T&) for every object of every cell the rect touches.
+	template<typename Visitor>
+	void retrieve(const QuadRect& rect, Visitor&& visitor) const
+	{
+		view().retrieve(rect, visitor);
+	}
+
+	// Calls visitor(const T&) for every object whose bounds overlap rect,
+	// touching edges count as overlap.
+	template<typename Visitor>
+	void query(const QuadRect& rect, Visitor&& visitor) const
+	{
+		view().query(rect, visitor);
+	}
+
+	// valid until the tree is modified
+	View view() const
+	{
+		return View(m_keys.data(), m_directory.data(), m_entries.data(), m_entries.size(), m_bounds, m_depth, m_directoryLevel);
+	}
+
+	size_t size() const
+	{
+		return m_entries.size();
+	}
+
+	void clear()
+	{
+		m_keys.clear();
+		m_entries.clear();
+		buildDirectory();
+	}
+
+	// Appends the header, the keys and the entries to out.
+	void serialize(std::vector<uint8_t>& out) const
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "serialized payloads have to be trivially copyable");
+
+		LinearQuadtreeHeader header = {};
+		header.magic = LinearQuadtreeHeader::Magic;
+		header.entrySize = sizeof(Entry);
+		header.count = m_entries.size();
+		header.bounds = m_bounds;
+		header.depth = m_depth;
+		header.directoryLevel = m_directoryLevel;
+
+		auto count = m_entries.size();
+		auto keysOffset = sizeof(header);
+		auto directoryOffset = keysOffset + count * sizeof(uint64_t);
+		auto entriesOffset = View::entriesOffset(count, m_directoryLevel);
+		auto offset = out.size();
+		out.resize(offset + entriesOffset + count * sizeof(Entry));
+		std::memcpy(out.data() + offset, &header, sizeof(header));
+		std::memcpy(out.data() + offset + directoryOffset, m_directory.data(), m_directory.size() * sizeof(uint32_t));
+		if (count > 0)
+		{
+			std::memcpy(out.data() + offset + keysOffset, m_keys.data(), count * sizeof(uint64_t));
+			std::memcpy(out.data() + offset + entriesOffset, m_entries.data(), count * sizeof(Entry));
+		}
+	}
+
+	// Copies serialized bytes back into a tree, false if they don't match T.
+	bool deserialize(const void* data, size_t size)
+	{
+		View source;
+		if (!View::fromBytes(data, size, source))
+		{
+			return false;
+		}
+		m_bounds = source.getBounds();
+		m_depth = source.getDepth();
+		m_directoryLevel = source.getDirectoryLevel();
+		m_keys.assign(source.keys(), source.keys() + source.size());
+		m_directory.assign(source.directory(), source.directory() + View::directorySize(m_directoryLevel));
+		m_entries.assign(source.entries(), source.entries() + source.size());
+		return true;
+	}
+
+	void debugDraw(ImDrawList* draw_list, ImVec2 canvas_pos) const
+	{
+		// outline every cell that holds objects
+		auto cells = 1u << m_depth;
+		auto cellWidth = m_bounds.width / cells;
+		auto cellHeight = m_bounds.height / cells;
+		auto previous = ~0ull;
+		for (auto key : m_keys)
+		{
+			if (key == previous)
+			{
+				continue;
+			}
+			previous = key;
+
+			auto level = static_cast<uint32_t>(key & ((1u << View::LevelBits) - 1));
+			auto code = static_cast<uint32_t>(key >> View::LevelBits);
+			auto span = static_cast<float>(1u << (m_depth - level));
+			auto x = m_bounds.x + compactBits(code) * cellWidth;
+			auto y = m_bounds.y + compactBits(code >> 1) * cellHeight;
+			draw_list->AddRect(ImVec2(x + canvas_pos.x + 0.5f, y + canvas_pos.y + 0.5f),
+				ImVec2(x + canvas_pos.x + span * cellWidth - 0.5f, y + canvas_pos.y + span * cellHeight - 0.5f),
+				IM_COL32(200, 120, 255, 255));
+		}
+	}
+
+private:
+
+	uint64_t makeKey(const QuadRect& rect) const
+	{
+		auto level = 0u;
+		auto x = 0u;
+		auto y = 0u;
+		if (containsRect(m_bounds, rect))
+		{
+			auto probe = view();
+			auto minX = probe.quantizeX(rect.x);
+			auto minY = probe.quantizeY(rect.y);
+			auto maxX = probe.quantizeX(rect.x + rect.width);
+			auto maxY = probe.quantizeY(rect.y + rect.height);
+
+			// levels below the highest differing bit split the object
+			auto differ = (minX ^ maxX) | (minY ^ maxY);
+			auto shift = 0u;
+			while (differ >> shift)
+			{
+				shift++;
+			}
+			level = m_depth - shift;
+			x = minX >> shift << shift;
+			y = minY >> shift << shift;
+		}
+		return (static_cast<uint64_t>(View::interleave(x, y)) << View::LevelBits) | level;
+	}
+
+	// about eight objects per directory cell
+	uint32_t directoryLevelFor(size_t count) const
+	{
+		uint32_t level = 0;
+		while (level < std::min<uint32_t>(m_depth, View::MaxDirectoryLevel) &&
+			(static_cast<size_t>(8) << (2 * (level + 1))) <= count)
+		{
+			level++;
+		}
+		return level;
+	}
+
+	// After one object with key was inserted (1) or removed (-1), only the
+	// cells behind its own start elsewhere. The directory is rebuilt when the
+	// count crosses to another level, which gets rarer as it grows.
+	void updateDirectory(uint64_t key, int delta)
+	{
+		if (directoryLevelFor(m_keys.size()) != m_directoryLevel)
+		{
+			buildDirectory();
+			return;
+		}
+		auto shift = 2 * (m_depth - m_directoryLevel) + View::LevelBits;
+		auto keyCell = static_cast<size_t>(key >> shift);
+		for (auto cell = keyCell + 1; cell < m_directory.size(); ++cell)
+		{
+			m_directory[cell] += delta;
+		}
+	}
+
+	void buildDirectory()
+	{
+		m_directoryLevel = directoryLevelFor(m_keys.size());
+
+		auto cells = static_cast<uint32_t>(View::directorySize(m_directoryLevel) - 1);
+		auto shift = 2 * (m_depth - m_directoryLevel) + View::LevelBits;
+		m_directory.resize(cells + 1);
+		uint32_t cell = 0;
+		for (size_t i = 0; i < m_keys.size(); ++i)
+		{
+			auto keyCell = static_cast<uint32_t>(m_keys[i] >> shift);
+			while (cell <= keyCell)
+			{
+				m_directory[cell++] = static_cast<uint32_t>(i);
+			}
+		}
+		while (cell <= cells)
+		{
+			m_directory[cell++] = static_cast<uint32_t>(m_keys.size());
+		}
+	}
+
+	static uint32_t compactBits(uint32_t value)
+	{
+		value &= 0x55555555;
+		value = (value | (value >> 1)) & 0x33333333;
+		value = (value | (value >> 2)) & 0x0f0f0f0f;
+		value = (value | (value >> 4)) & 0x00ff00ff;
+		value = (value | (value >> 8)) & 0x0000ffff;
+		return value;
+	}
+
+	static bool containsRect(const QuadRect& outer, const QuadRect& inner)
+	{
+		return outer.x <= inner.x && inner.x + inner.width <= outer.x + outer.width &&
+			outer.y <= inner.y && inner.y + inner.height <= outer.y + outer.height;
+	}
+
+private:
+	QuadRect m_bounds;
+	uint32_t m_depth;
+	std::vector<uint64_t> m_keys;
+	std::vector<Entry> m_entries;
+	uint32_t m_directoryLevel;
+	std::vector<uint32_t> m_directory;
+	// build() scratch, key and item index
+	std::vector<std::pair<uint64_t, uint32_t>> m_buildOrder;
+};
@@ -0,0 +1,419 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+
+#include "imgui.h"
+
+#include "Quadtree.h"
+
+// Loose quadtree: every cell accepts objects whose center lies inside it and
+// whose size fits into the cell enlarged by the looseness factor, so each
+// object is stored in exactly one cell. The level follows from the object size
+// and the cell from its center, both in O(1), no descent is needed.
+//
+// The cells of all levels are preallocated in one array, level d is a dense
+// 2^d x 2^d grid. Every cell keeps the number of objects in its subtree so
+// queries skip empty branches. Objects whose center lies outside the bounds or
+// that are too large for any cell go to the root, which every query visits.
+template<typename T>
+class LooseQuadtree
+{
+public:
+
+	typedef int32_t Handle;
+
+	LooseQuadtree(QuadRect bounds, uint32_t depth = 6, float looseness = 2.0f)
+		: m_bounds(bounds)
+		, m_depth(std::max(1u, std::min(depth, static_cast<uint32_t>(MaxDepth))))
+		, m_looseness(std::max(1.0f, looseness))
+		, m_freeElement(-1)
+	{
+		m_cells.resize(levelOffset(m_depth), { -1, 0, 0 });
+	}
+
+	Handle insert(const QuadRect& rect, const T& data)
+	{
+		int32_t element;
+		if (m_freeElement != -1)
+		{
+			element = m_freeElement;
+			m_freeElement = m_elements[element].next;
+			m_elements[element].bounds = rect;
+			m_elements[element].data = data;
+		}
+		else
+		{
+			element = static_cast<int32_t>(m_elements.size());
+			m_elements.push_back({ rect, data, -1, -1 });
+		}
+		link(element, selectCell(rect));
+		return element;
+	}
+
+	void remove(Handle handle)
+	{
+		assert(isLive(handle));
+		unlink(handle);
+		auto& obj = m_elements[handle];
+		obj.data = T();
+		obj.next = m_freeElement;
+		obj.cell = -1;
+		m_freeElement = handle;
+	}
+
+	void update(Handle handle, const QuadRect& rect)
+	{
+		assert(isLive(handle));
+		auto cell = selectCell(rect);
+		m_elements[handle].bounds = rect;
+		if (cell != m_elements[handle].cell)
+		{
+			unlink(handle);
+			link(handle, cell);
+		}
+	}
+
+	const QuadRect& getBounds(Handle handle) const
+	{
+		return m_elements[handle].bounds;
+	}
+
+	void retrieve(const QuadRect& rect, std::vector<T>& returnObjects) const
+	{
+		retrieve(rect, [&returnObjects](const T& data)
+		{
+			returnObjects.push_back(data);
+		});
+	}
+
+	// Calls visitor(const T&) for every object of every cell whose loose
+	// bounds touch the rect.
+	template<typename Visitor>
+	void retrieve(const QuadRect& rect, Visitor&& visitor) const
+	{
+		visitCell(0, 0, 0, rect, false, visitor);
+	}
+
+	// Calls visitor(const T&) for every object whose bounds overlap rect,
+	// touching edges count as overlap.
+	template<typename Visitor>
+	void query(const QuadRect& rect, Visitor&& visitor) const
+	{
+		visitCell(0, 0, 0, rect, true, visitor);
+	}
+
+	void clear()
+	{
+		m_elements.clear();
+		m_freeElement = -1;
+		std::fill(m_cells.begin(), m_cells.end(), Cell{ -1, 0, 0 });
+	}
+
+	QuadtreeStats getStats() const
+	{
+		QuadtreeStats stats = {};
+		for (uint32_t level = 0; level < m_depth; ++level)
+		{
+			for (auto cell = levelOffset(level); cell < levelOffset(level + 1); ++cell)
+			{
+				if (m_cells[cell].subtreeCount == 0)
+				{
+					continue;
+				}
+				stats.nodeCount++;
+				if (m_cells[cell].count > 0)
+				{
+					stats.leafCount++;
+					stats.maxDepth = std::max(stats.maxDepth, level);
+					stats.maxLeafOccupancy = std::max(stats.maxLeafOccupancy, m_cells[cell].count);
+				}
+			}
+		}
+		stats.objectCount = m_cells[0].subtreeCount;
+		stats.linkCount = stats.objectCount;
+		return stats;
+	}
+
+	// draws the non-empty cells, the loose bounds of cells holding objects dimmed
+	void debugDraw(ImDrawList* draw_list, ImVec2 canvas_pos) const
+	{
+		debugDrawCell(0, 0, 0, draw_list, canvas_pos);
+	}
+
+private:
+
+	enum : uint32_t { MaxDepth = 12 };
+
+	struct Cell
+	{
+		int32_t firstElement;
+		// objects stored in this cell
+		uint32_t count;
+		// objects stored in this cell and below
+		uint32_t subtreeCount;
+	};
+
+	struct Element
+	{
+		QuadRect bounds;
+		T data;
+		// next element of the cell, or next free slot
+		int32_t next;
+		// -1 while the slot is free
+		int32_t cell;
+	};
+
+	bool isLive(Handle handle) const
+	{
+		return handle >= 0 && static_cast<size_t>(handle) < m_elements.size() && m_elements[handle].cell != -1;
+	}
+
+	static uint32_t levelOffset(uint32_t level)
+	{
+		// 1 + 4 + 16 + ... cells precede the level
+		return ((1u << (2 * level)) - 1) / 3;
+	}
+
+	uint32_t cellIndex(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		return levelOffset(level) + (y << level) + x;
+	}
+
+	QuadRect cellBounds(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		auto width = m_bounds.width / (1u << level);
+		auto height = m_bounds.height / (1u << level);
+		return QuadRect(m_bounds.x + x * width, m_bounds.y + y * height, width, height);
+	}
+
+	QuadRect looseBounds(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		auto bounds = cellBounds(level, x, y);
+		auto marginX = bounds.width * (m_looseness - 1.0f) * 0.5f;
+		auto marginY = bounds.height * (m_looseness - 1.0f) * 0.5f;
+		return QuadRect(bounds.x - marginX, bounds.y - marginY, bounds.width + marginX * 2, bounds.height + marginY * 2);
+	}
+
+	// the lower of level and the level where the cells are ratio times the
+	// object, never below the root even for infinite objects
+	static int fitLevel(int level, float ratio)
+	{
+		auto fit = std::log2(ratio);
+		if (fit < static_cast<float>(level))
+		{
+			return static_cast<int>(std::max(std::floor(fit), 0.0f));
+		}
+		return level;
+	}
+
+	int32_t selectCell(const QuadRect& rect) const
+	{
+		auto cx = rect.x + rect.width * 0.5f - m_bounds.x;
+		auto cy = rect.y + rect.height * 0.5f - m_bounds.y;
+		if (!(cx >= 0.0f && cx < m_bounds.width && cy >= 0.0f && cy < m_bounds.height))
+		{
+			return 0;
+		}
+
+		// deepest level whose cells still take the object once enlarged,
+		// level d fits sizes up to (looseness - 1) * size / 2^d. Without any
+		// looseness the search below starts at the bottom and finds the
+		// deepest cell that holds the object as it is.
+		auto slack = m_looseness - 1.0f;
+		auto level = static_cast<int>(m_depth) - 1;
+		if (slack > 0.0f && rect.width > 0.0f)
+		{
+			level = fitLevel(level, slack * m_bounds.width / rect.width);
+		}
+		if (slack > 0.0f && rect.height > 0.0f)
+		{
+			level = fitLevel(level, slack * m_bounds.height / rect.height);
+		}
+
+		// rounding can push the object a hair past the loose bounds, queries
+		// prune on those bounds so step up until it really fits
+		for (; level > 0; --level)
+		{
+			auto cells = 1u << level;
+			auto x = std::min(static_cast<uint32_t>(cx / m_bounds.width * cells), cells - 1);
+			auto y = std::min(static_cast<uint32_t>(cy / m_bounds.height * cells), cells - 1);
+			if (containsRect(looseBounds(level, x, y), rect))
+			{
+				return static_cast<int32_t>(cellIndex(level, x, y));
+			}
+		}
+		return 0;
+	}
+
+	void link(int32_t element, int32_t cell)
+	{
+		auto& obj = m_elements[element];
+		obj.cell = cell;
+		obj.next = m_cells[cell].firstElement;
+		m_cells[cell].firstElement = element;
+		m_cells[cell].count++;
+		addSubtreeCount(cell, 1);
+	}
+
+	void unlink(int32_t element)
+	{
+		auto cell = m_elements[element].cell;
+		auto* next = &m_cells[cell].firstElement;
+		while (*next != element)
+		{
+			next = &m_elements[*next].next;
+		}
+		*next = m_elements[element].next;
+		m_cells[cell].count--;
+		addSubtreeCount(cell, -1);
+	}
+
+	void addSubtreeCount(int32_t cell, int32_t delta)
+	{
+		// walk the level/coordinate pairs up to the root
+		uint32_t level = 0;
+		while (level + 1 < m_depth && levelOffset(level + 1) <= static_cast<uint32_t>(cell))
+		{
+			level++;
+		}
+		auto local = static_cast<uint32_t>(cell) - levelOffset(level);
+		auto x = local & ((1u << level) - 1);
+		auto y = local >> level;
+		for (;;)
+		{
+			m_cells[cellIndex(level, x, y)].subtreeCount += delta;
+			if (level == 0)
+			{
+				break;
+			}
+			level--;
+			x >>= 1;
+			y >>= 1;
+		}
+	}
+
+	template<typename Visitor>
+	void visitCell(uint32_t level, uint32_t x, uint32_t y, const QuadRect& rect, bool exact, Visitor& visitor) const
+	{
+		const auto& cell = m_cells[cellIndex(level, x, y)];
+		for (auto element = cell.firstElement; element != -1; element = m_elements[element].next)
+		{
+			const auto& obj = m_elements[element];
+			if (!exact || overlapsRect(obj.bounds, rect))
+			{
+				visitor(obj.data);
+			}
+		}
+
+		if (level + 1 >= m_depth)
+		{
+			return;
+		}
+
+		for (uint32_t index = 0; index < 4; ++index)
+		{
+			auto childX = x * 2 + (index & 1);
+			auto childY = y * 2 + (index >> 1);
+			if (m_cells[cellIndex(level + 1, childX, childY)].subtreeCount == 0)
+			{
+				continue;
+			}
+
+			auto loose = looseBounds(level + 1, childX, childY);
+			if (!overlapsRect(loose, rect))
+			{
+				continue;
+			}
+			if (exact && containsRect(rect, loose))
+			{
+				// everything below lies inside the loose bounds
+				visitSubtree(level + 1, childX, childY, visitor);
+				continue;
+			}
+			visitCell(level + 1, childX, childY, rect, exact, visitor);
+		}
+	}
+
+	template<typename Visitor>
+	void visitSubtree(uint32_t level, uint32_t x, uint32_t y, Visitor& visitor) const
+	{
+		const auto& cell = m_cells[cellIndex(level, x, y)];
+		for (auto element = cell.firstElement; element != -1; element = m_elements[element].next)
+		{
+			visitor(m_elements[element].data);
+		}
+
+		if (level + 1 >= m_depth)
+		{
+			return;
+		}
+
+		for (uint32_t index = 0; index < 4; ++index)
+		{
+			auto childX = x * 2 + (index & 1);
+			auto childY = y * 2 + (index >> 1);
+			if (m_cells[cellIndex(level + 1, childX, childY)].subtreeCount != 0)
+			{
+				visitSubtree(level + 1, childX, childY, visitor);
+			}
+		}
+	}
+
+	void debugDrawCell(uint32_t level, uint32_t x, uint32_t y, ImDrawList* draw_list, ImVec2 canvas_pos) const
+	{
+		const auto& cell = m_cells[cellIndex(level, x, y)];
+
+		auto bounds = cellBounds(level, x, y);
+		draw_list->AddRect(ImVec2(bounds.x + canvas_pos.x + 0.5f, bounds.y + canvas_pos.y + 0.5f),
+			ImVec2(bounds.x + canvas_pos.x + bounds.width - 0.5f, bounds.y + canvas_pos.y + bounds.height - 0.5f),
+			IM_COL32(0, 200, 200, 255));
+
+		if (cell.count > 0 && level > 0)
+		{
+			auto loose = looseBounds(level, x, y);
+			draw_list->AddRect(ImVec2(loose.x + canvas_pos.x, loose.y + canvas_pos.y),
+				ImVec2(loose.x + canvas_pos.x + loose.width, loose.y + canvas_pos.y + loose.height),
+				IM_COL32(0, 200, 200, 60));
+		}
+
+		if (level + 1 >= m_depth)
+		{
+			return;
+		}
+
+		for (uint32_t index = 0; index < 4; ++index)
+		{
+			auto childX = x * 2 + (index & 1);
+			auto childY = y * 2 + (index >> 1);
+			if (m_cells[cellIndex(level + 1, childX, childY)].subtreeCount != 0)
+			{
+				debugDrawCell(level + 1, childX, childY, draw_list, canvas_pos);
+			}
+		}
+	}
+
+	static bool containsRect(const QuadRect& outer, const QuadRect& inner)
+	{
+		return outer.x <= inner.x && inner.x + inner.width <= outer.x + outer.width &&
+			outer.y <= inner.y && inner.y + inner.height <= outer.y + outer.height;
+	}
+
+	static bool overlapsRect(const QuadRect& a, const QuadRect& b)
+	{
+		return !(a.x + a.width < b.x || b.x + b.width < a.x ||
+			a.y + a.height < b.y || b.y + b.height < a.y);
+	}
+
+private:
+	QuadRect m_bounds;
+	uint32_t m_depth;
+	float m_looseness;
+
+	std::vector<Cell> m_cells;
+	std::vector<Element> m_elements;
+	int32_t m_freeElement;
+};
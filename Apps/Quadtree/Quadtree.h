@@ -4,12 +4,43 @@
 #include <memory>
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <utility>
+#include <limits>
+#include <cmath>
+#include <thread>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define QUADTREE_SIMD_AVX
+#if defined(__AVX512F__)
+#define QUADTREE_SIMD_AVX512
+#endif
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUADTREE_SIMD_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #include "imgui.h"
+#include "collision/CircleToBox.h"
 
 
 struct QuadRect
 {
+	QuadRect()
+		: x(0.0f)
+		, y(0.0f)
+		, width(0.0f)
+		, height(0.0f)
+	{
+	}
 	QuadRect(float _x, float _y, float _w, float _h)
 		: x(_x)
 		, y(_y)
@@ -23,15 +54,205 @@ struct QuadRect
 	float height;
 };
 
+struct QuadtreePolicy
+{
+	QuadtreePolicy(uint32_t _maxObjects = 10, uint32_t _maxLevels = 4, bool _adaptive = false, bool _storeStraddlersInParent = false)
+		: maxObjects(_maxObjects)
+		, maxLevels(_maxLevels)
+		, adaptive(_adaptive)
+		, storeStraddlersInParent(_storeStraddlersInParent)
+	{
+	}
+	// a leaf holding more objects than this is split
+	uint32_t maxObjects;
+	// depth limit, ignored in adaptive mode
+	uint32_t maxLevels;
+	// split a full leaf at any depth as long as that lowers the occupancy of
+	// its children, but not when its objects would mostly be copied into all
+	// four of them or the remaining ones already fit
+	bool adaptive;
+	bool storeStraddlersInParent;
+};
+
+struct QuadtreeStats
+{
+	uint32_t nodeCount;
+	uint32_t leafCount;
+	uint32_t maxDepth;
+	uint32_t maxLeafOccupancy;
+	uint32_t objectCount;
+	// element links, an object straddling several leaves counts once per leaf
+	uint32_t linkCount;
+
+	float duplicationFactor() const
+	{
+		return objectCount ? static_cast<float>(linkCount) / objectCount : 0.0f;
+	}
+};
+
+// Allocator for std::vector whose storage starts on an Alignment boundary,
+// so SIMD code can use aligned loads. The pointer operator new returned is
+// kept in front of the aligned block.
+template<typename T, size_t Alignment>
+struct QuadtreeAlignedAllocator
+{
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef QuadtreeAlignedAllocator<U, Alignment> other;
+	};
+
+	QuadtreeAlignedAllocator()
+	{
+	}
+
+	template<typename U>
+	QuadtreeAlignedAllocator(const QuadtreeAlignedAllocator<U, Alignment>&)
+	{
+	}
+
+	T* allocate(size_t count)
+	{
+		auto raw = static_cast<char*>(::operator new(count * sizeof(T) + Alignment + sizeof(void*)));
+		auto address = reinterpret_cast<uintptr_t>(raw + sizeof(void*));
+		auto aligned = reinterpret_cast<char*>((address + Alignment - 1) / Alignment * Alignment);
+		reinterpret_cast<void**>(aligned)[-1] = raw;
+		return reinterpret_cast<T*>(aligned);
+	}
+
+	void deallocate(T* ptr, size_t)
+	{
+		::operator delete(reinterpret_cast<void**>(ptr)[-1]);
+	}
+
+	template<typename U>
+	bool operator==(const QuadtreeAlignedAllocator<U, Alignment>&) const
+	{
+		return true;
+	}
+
+	template<typename U>
+	bool operator!=(const QuadtreeAlignedAllocator<U, Alignment>&) const
+	{
+		return false;
+	}
+};
+
+// Dedup state of the queries. The query functions without a scratch argument
+// share one owned by the tree; pass one per thread to query concurrently.
+struct QuadtreeQueryScratch
+{
+	QuadtreeQueryScratch()
+		: epoch(0)
+	{
+	}
+
+	// grows the stamps to cover every element and starts a new query
+	uint32_t nextEpoch(size_t elementCount)
+	{
+		if (visitStamps.size() < elementCount)
+		{
+			visitStamps.resize(elementCount, 0);
+			batchReported.resize(elementCount, 0);
+		}
+		if (++epoch == 0)
+		{
+			std::fill(visitStamps.begin(), visitStamps.end(), 0u);
+			epoch = 1;
+		}
+		return epoch;
+	}
+
+	// stamp of the last query that reported the element, indexed by handle
+	std::vector<uint32_t> visitStamps;
+	uint32_t epoch;
+	// queries of the current batch that already reported the element, valid
+	// while its stamp matches the batch epoch
+	std::vector<uint64_t> batchReported;
+	// queryBatch() order, morton code and index of every query
+	std::vector<std::pair<uint32_t, uint32_t>> batchOrder;
+
+	// nearest() queue entry, a node with its bounds or an element
+	struct NearestEntry
+	{
+		float distanceSq;
+		// node index, or -1 - element
+		int32_t index;
+		QuadRect bounds;
+
+		bool operator<(const NearestEntry& other) const
+		{
+			// std heaps keep the largest on top, the closest has to come first
+			return distanceSq > other.distanceSq;
+		}
+	};
+	std::vector<NearestEntry> nearestQueue;
+};
+
+// All nodes live in one contiguous array and are addressed by 32-bit indexes,
+// the four children of a node are allocated as one block. Objects are kept in
+// a shared element pool and referenced from the leaves through singly linked
+// element nodes, both pools recycle their slots through free lists.
+//
+// An object that straddles a split line is linked into every child it touches
+// by default, queries then filter the repeats with a per-element query stamp.
+// With QuadtreePolicy::storeStraddlersInParent the object stays in the lowest node that fully
+// contains it instead and every object is reported exactly once.
+//
+// insert returns a handle that stays valid until the object is removed, moving
+// an object with update only relinks it when it crosses into other nodes.
+// Nodes emptied by remove/update are collapsed the next time cleanup runs.
+//
+// compact() additionally copies the bounds and the index of every node's
+// objects into one array per side, each node's run starting on a vector
+// boundary, so until the next modification query tests 4, 8 or 16 objects of
+// a leaf per aligned load (SSE2, AVX, AVX-512).
+//
+// retrieve, query and queryBatch never modify the tree. Any number of threads
+// may call them at the same time as long as no thread modifies the tree
+// meanwhile; the overloads without a scratch argument use one per thread.
+//
+// Leaf capacity and depth limit come from a QuadtreePolicy that can be changed
+// at runtime, MaxObjects and MaxLevels only provide its defaults.
+//
+// The bounds passed to the constructor are only the initial root. An object
+// reaching outside of it makes the root double towards the object until it
+// fits, the old root becomes one quadrant of the new one and keeps its subtree.
 template<typename T, uint32_t MaxObjects = 10, uint32_t MaxLevels = 4>
 class Quadtree
 {
 public:
 
-	Quadtree(QuadRect bounds, int level = 0)
+	typedef int32_t Handle;
+	typedef QuadtreeQueryScratch QueryScratch;
+
+	// closest object a raycast accepted
+	struct RayHit
+	{
+		T data;
+		// along the normalized direction, maxDistance when nothing was hit
+		float distance;
+		bool hit;
+	};
+
+	Quadtree(QuadRect bounds, bool storeStraddlersInParent = false)
+		: Quadtree(bounds, QuadtreePolicy(MaxObjects, MaxLevels, false, storeStraddlersInParent))
+	{
+	}
+
+	Quadtree(QuadRect bounds, const QuadtreePolicy& policy)
 		: m_bounds(bounds)
-		, m_level(level)
+		, m_policy(policy)
+		, m_outsideCount(0)
+		, m_objectCount(0)
+		, m_freeNode(-1)
+		, m_freeElement(-1)
+		, m_freeElementNode(-1)
+		, m_packed(false)
 	{
+		m_nodes.push_back({ -1, -1, 0, 0, -1 });
 	}
 
 	~Quadtree()
@@ -39,171 +260,2132 @@ public:
 		clear();
 	}
 
-	void insert(const QuadRect& rect, const T& data)
+	Handle insert(const QuadRect& rect, const T& data)
+	{
+		m_packed = false;
+		grow(rect);
+		auto element = allocElement(rect, data);
+		insertElement(0, 0, m_bounds, element);
+		return element;
+	}
+
+	// Replaces the contents of the tree with items, the handle of items[i] is i.
+	// The objects are radix sorted by the Morton code of their center, which
+	// makes the objects of every node a contiguous range. The node hierarchy is
+	// laid out from the range sizes alone and every object that fits into the
+	// leaf of its center is linked there directly, so no leaf is ever split and
+	// redistributed. An object crossing a split line is linked afterwards from
+	// the deepest node that still fully contains it.
+	void build(const std::pair<QuadRect, T>* items, size_t count)
+	{
+		prepareBuild(items, count);
+
+		BuildTarget target = { m_nodes, m_elementNodes, m_buildDeferred };
+		BuildFrame path[MaxDepth + 1];
+		path[0] = rootFrame();
+		buildNode(target, path, 0, 0, m_buildOrder.size());
+		linkDeferred();
+	}
+
+	void build(const std::vector<std::pair<QuadRect, T>>& items)
+	{
+		build(items.data(), items.size());
+	}
+
+	// Same tree as build, but the four subtrees below the root are laid out on
+	// up to threadCount threads. Every subtree goes into nodes and element nodes
+	// of its own which are appended to the tree once all threads are done.
+	// Sorting and linking the objects crossing the root's split lines stay on
+	// the calling thread.
+	void buildParallel(const std::pair<QuadRect, T>* items, size_t count, uint32_t threadCount = 4)
 	{
-		if (this->m_nodes[0] != NULL)
+		prepareBuild(items, count);
+
+		auto root = rootFrame();
+		if (threadCount <= 1 || !buildSplits(root.bounds, 0, 0, m_buildOrder.size()))
 		{
-			auto indexes = this->getIndex(rect);
-			for (auto index : indexes)
-			{
-				this->m_nodes[index]->insert(rect, data);
-			}
+			BuildTarget target = { m_nodes, m_elementNodes, m_buildDeferred };
+			BuildFrame path[MaxDepth + 1];
+			path[0] = root;
+			buildNode(target, path, 0, 0, m_buildOrder.size());
+			linkDeferred();
 			return;
 		}
 
-		this->m_objects.push_back({ rect, data });
+		auto firstChild = allocChildren(0);
+		m_nodes[0].firstChild = firstChild;
+		size_t ranges[5];
+		splitBuildRange(0, 0, m_buildOrder.size(), ranges);
 
-		if (this->m_objects.size() > MaxObjects && this->m_level < MaxLevels)
+		m_buildArenas.resize(4);
+		auto buildQuadrant = [this, &root, &ranges](uint32_t digit)
 		{
-			if (this->m_nodes[0] == NULL)
-			{
-				split();
-			}
+			auto& arena = m_buildArenas[digit];
+			arena.nodes.clear();
+			arena.elementNodes.clear();
+			arena.deferred.clear();
+			// local node 0 stands for the root, node 1 is the subtree root
+			arena.nodes.push_back({ -1, -1, 0, 0, -1 });
+			arena.nodes.push_back({ -1, -1, 0, 0, 0 });
 
-			for (auto& obj : this->m_objects)
+			BuildFrame path[MaxDepth + 1];
+			path[0] = root;
+			setChildFrame(path, 0, digit);
+			path[1].node = 1;
+			BuildTarget target = { arena.nodes, arena.elementNodes, arena.deferred };
+			buildNode(target, path, 1, ranges[digit], ranges[digit + 1]);
+		};
+
+		threadCount = std::min(threadCount, 4u);
+		std::vector<std::thread> threads;
+		for (uint32_t thread = 1; thread < threadCount; ++thread)
+		{
+			threads.emplace_back([&buildQuadrant, thread, threadCount]()
 			{
-				auto indexes = this->getIndex(obj.bounds);
-				for (auto& index : indexes)
+				for (auto digit = thread; digit < 4; digit += threadCount)
 				{
-					this->m_nodes[index]->insert(obj.bounds, obj.data);
+					buildQuadrant(digit);
 				}
-			}
+			});
+		}
+		for (uint32_t digit = 0; digit < 4; digit += threadCount)
+		{
+			buildQuadrant(digit);
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		for (uint32_t digit = 0; digit < 4; ++digit)
+		{
+			stitchArena(m_buildArenas[digit], firstChild + childFromMortonDigit(digit));
+		}
+		linkDeferred();
+	}
+
+	void buildParallel(const std::vector<std::pair<QuadRect, T>>& items, uint32_t threadCount = 4)
+	{
+		buildParallel(items.data(), items.size(), threadCount);
+	}
+
+	void remove(Handle handle)
+	{
+		assert(isLive(handle));
+		m_packed = false;
+		auto& obj = m_elements[handle];
+		unlinkElement(0, m_bounds, obj.bounds, handle);
+
+		if (!containsRect(m_bounds, obj.bounds))
+		{
+			m_outsideCount--;
+		}
+		obj.data = T();
+		obj.nextFree = m_freeElement;
+		m_freeElement = handle;
+		m_objectCount--;
+	}
+
+	void update(Handle handle, const QuadRect& rect)
+	{
+		assert(isLive(handle));
+		m_packed = false;
+		grow(rect);
+
+		auto& obj = m_elements[handle];
+		auto wasOutside = !containsRect(m_bounds, obj.bounds);
+		auto isOutside = !containsRect(m_bounds, rect);
+		m_outsideCount += (isOutside ? 1 : 0) - (wasOutside ? 1 : 0);
 
-			this->m_objects.clear();
+		// still linked into exactly the same nodes, only the bounds change
+		if (samePlacement(0, m_bounds, obj.bounds, rect))
+		{
+			obj.bounds = rect;
+			return;
 		}
+
+		unlinkElement(0, m_bounds, obj.bounds, handle);
+		m_elements[handle].bounds = rect;
+		insertElement(0, 0, m_bounds, handle);
+	}
+
+	const QuadRect& getBounds(Handle handle) const
+	{
+		return m_elements[handle].bounds;
 	}
 
-	void retrieve(const QuadRect& rect, std::vector<T>& returnObjects)
+	// current root bounds, only ever grows past the ones given to the constructor
+	const QuadRect& getRootBounds() const
 	{
-		for (auto& obj : m_objects)
+		return m_bounds;
+	}
+
+	const QuadtreePolicy& getPolicy() const
+	{
+		return m_policy;
+	}
+
+	// Lays the current objects out again under the new policy, handles stay
+	// valid.
+	void setPolicy(const QuadtreePolicy& policy)
+	{
+		m_policy = policy;
+		m_packed = false;
+		relinkAll();
+	}
+
+	QuadtreeStats getStats() const
+	{
+		QuadtreeStats stats = {};
+		stats.objectCount = m_objectCount;
+		collectStats(0, 0, stats);
+		return stats;
+	}
+
+	// Collapses the subtrees that remove/update left with few enough objects to
+	// fit into one leaf again. Only nodes touched since the last call are
+	// visited, so calling it once per frame costs nothing for a static scene.
+	void cleanup()
+	{
+		while (!m_dirtyNodes.empty())
 		{
-			if (std::find(returnObjects.begin(), returnObjects.end(), obj.data) == returnObjects.end())
+			auto nodeIndex = m_dirtyNodes.back();
+			m_dirtyNodes.pop_back();
+			m_nodes[nodeIndex].dirty = 0;
+
+			if (tryMerge(nodeIndex) && nodeIndex != 0)
 			{
-				returnObjects.push_back(obj.data);
+				markDirty(m_nodes[nodeIndex].parent);
 			}
 		}
+	}
+
+	// Runs cleanup and lays the nodes out again breadth first with the element
+	// nodes of every node next to each other, dropping the free slots left by
+	// remove/update, and packs the object bounds for query. Handles stay
+	// valid. Meant for trees that are only read from now on.
+	void compact()
+	{
+		cleanup();
 
-		if (this->m_nodes[0] != NULL)
+		m_compactNodes.clear();
+		m_compactElementNodes.clear();
+		m_compactSource.clear();
+		m_packedMinX.clear();
+		m_packedMinY.clear();
+		m_packedMaxX.clear();
+		m_packedMaxY.clear();
+		m_packedElement.clear();
+		m_packedFirst.clear();
+		m_compactNodes.push_back(m_nodes[0]);
+		m_compactSource.push_back(0);
+		for (size_t i = 0; i < m_compactNodes.size(); ++i)
 		{
-			auto indexes = this->getIndex(rect);
-			for (auto index : indexes)
+			const auto& source = m_nodes[m_compactSource[i]];
+
+			auto prev = -1;
+			m_compactNodes[i].firstElement = -1;
+			m_packedFirst.push_back(static_cast<uint32_t>(m_packedElement.size()));
+			for (auto elementNode = source.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+			{
+				auto index = static_cast<int32_t>(m_compactElementNodes.size());
+				auto element = m_elementNodes[elementNode].element;
+				m_compactElementNodes.push_back({ -1, element });
+				const auto& rect = m_elements[element].bounds;
+				m_packedMinX.push_back(rect.x);
+				m_packedMinY.push_back(rect.y);
+				m_packedMaxX.push_back(rect.x + rect.width);
+				m_packedMaxY.push_back(rect.y + rect.height);
+				m_packedElement.push_back(element);
+				if (prev == -1)
+					m_compactNodes[i].firstElement = index;
+				else
+					m_compactElementNodes[prev].next = index;
+				prev = index;
+			}
+			this->padPacked();
+
+			if (source.firstChild != -1)
 			{
-				this->m_nodes[index]->retrieve(rect, returnObjects);
+				auto firstChild = static_cast<int32_t>(m_compactNodes.size());
+				for (auto index = 0; index < 4; ++index)
+				{
+					auto child = m_nodes[source.firstChild + index];
+					child.parent = static_cast<int32_t>(i);
+					m_compactNodes.push_back(child);
+					m_compactSource.push_back(source.firstChild + index);
+				}
+				m_compactNodes[i].firstChild = firstChild;
 			}
 		}
+
+		m_nodes.swap(m_compactNodes);
+		m_elementNodes.swap(m_compactElementNodes);
+		m_freeNode = -1;
+		m_freeElementNode = -1;
+		m_packed = true;
 	}
 
-	void clear()
+	// Appends the candidates to returnObjects without clearing it, callers that
+	// keep the vector between queries only pay for its growth once.
+	void retrieve(const QuadRect& rect, std::vector<T>& returnObjects) const
 	{
-		this->m_objects.clear();
-		for (auto& node : this->m_nodes)
+		retrieve(rect, returnObjects, threadScratch());
+	}
+
+	void retrieve(const QuadRect& rect, std::vector<T>& returnObjects, QueryScratch& scratch) const
+	{
+		retrieve(rect, [&returnObjects](const T& data)
 		{
-			node.release();
-		}
+			returnObjects.push_back(data);
+		}, scratch);
 	}
 
-	void debugDraw(ImDrawList* draw_list, ImVec2 canvas_pos, int index = 0)
+	// Calls visitor(const T&) once for every object stored in a node the rect
+	// touches.
+	template<typename Visitor>
+	void retrieve(const QuadRect& rect, Visitor&& visitor) const
 	{
-		const float offset_value = 0.5f;
+		retrieve(rect, visitor, threadScratch());
+	}
 
-		ImVec2 v[4];
-		v[0].x = m_bounds.x + canvas_pos.x + offset_value;
-		v[0].y = m_bounds.y + canvas_pos.y + offset_value;
+	template<typename Visitor>
+	void retrieve(const QuadRect& rect, Visitor&& visitor, QueryScratch& scratch) const
+	{
+		if (m_policy.storeStraddlersInParent)
+		{
+			auto emit = [this, &visitor](int32_t element)
+			{
+				visitor(m_elements[element].data);
+			};
+			retrieveNode(0, m_bounds, rect, emit);
+			return;
+		}
 
-		v[1].x = m_bounds.x + canvas_pos.x + offset_value;
-		v[1].y = m_bounds.y + canvas_pos.y + m_bounds.height - offset_value;
+		auto epoch = scratch.nextEpoch(m_elements.size());
+		auto emit = [this, &visitor, &scratch, epoch](int32_t element)
+		{
+			if (scratch.visitStamps[element] != epoch)
+			{
+				scratch.visitStamps[element] = epoch;
+				visitor(m_elements[element].data);
+			}
+		};
+		retrieveNode(0, m_bounds, rect, emit);
+	}
 
-		v[2].x = m_bounds.x + canvas_pos.x + m_bounds.width - offset_value;
-		v[2].y = m_bounds.y + canvas_pos.y + m_bounds.height - offset_value;
+	// Calls visitor(const T&) once for every object whose bounds overlap rect,
+	// touching edges count as overlap. Nodes outside rect are skipped and the
+	// contents of nodes inside rect are reported without per-object tests.
+	template<typename Visitor>
+	void query(const QuadRect& rect, Visitor&& visitor) const
+	{
+		query(rect, visitor, threadScratch());
+	}
 
-		v[3].x = m_bounds.x + canvas_pos.x + m_bounds.width - offset_value;
-		v[3].y = m_bounds.y + canvas_pos.y + offset_value;
+	template<typename Visitor>
+	void query(const QuadRect& rect, Visitor&& visitor, QueryScratch& scratch) const
+	{
+		if (m_policy.storeStraddlersInParent)
+		{
+			auto emit = [this, &visitor](int32_t element)
+			{
+				visitor(m_elements[element].data);
+			};
+			queryNode(0, m_bounds, rect, emit);
+			return;
+		}
 
-		draw_list->AddPolyline(v, 4, IM_COL32(0, 200, 200, 255), true, 0.0f);
+		auto epoch = scratch.nextEpoch(m_elements.size());
+		auto emit = [this, &visitor, &scratch, epoch](int32_t element)
+		{
+			if (scratch.visitStamps[element] != epoch)
+			{
+				scratch.visitStamps[element] = epoch;
+				visitor(m_elements[element].data);
+			}
+		};
+		queryNode(0, m_bounds, rect, emit);
+	}
 
-		//static unsigned int colorArray[4] = {
-		//	IM_COL32(100, 100, 0, 200),
-		//	IM_COL32(150, 0, 0, 200),
-		//	IM_COL32(0, 150, 0, 200),
-		//	IM_COL32(0, 0, 150, 200),
-		//};
+	// Runs query for every rect and calls visitor(size_t queryIndex, const T&)
+	// for every hit. The queries are sorted by the Morton code of their center
+	// and taken 64 at a time, each group walks the tree once and every node
+	// keeps a bit mask of the queries still reaching it. The queries are stored
+	// as lanes so one node or object is tested against 4 (SSE2) or 8 (AVX) of
+	// them per instruction. Pays off when the queries of a group share nodes,
+	// as for many agents in the same area.
+	template<typename Visitor>
+	void queryBatch(const QuadRect* rects, size_t count, Visitor&& visitor) const
+	{
+		queryBatch(rects, count, visitor, threadScratch());
+	}
 
-		//draw_list->AddPolyline(v, 4, colorArray[index], true, 0.0f);
+	template<typename Visitor>
+	void queryBatch(const QuadRect* rects, size_t count, Visitor&& visitor, QueryScratch& scratch) const
+	{
+		auto& order = scratch.batchOrder;
+		order.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			order[i] = { mortonCode(rects[i]), static_cast<uint32_t>(i) };
+		}
+		std::sort(order.begin(), order.end());
 
-		if (this->m_nodes[0] != NULL)
+		BatchQueries queries;
+		for (size_t base = 0; base < count; base += BatchSize)
 		{
-			index = 0;
-			for(auto& node : this->m_nodes)
+			auto size = static_cast<uint32_t>(std::min<size_t>(BatchSize, count - base));
+			for (uint32_t i = 0; i < BatchSize; ++i)
 			{
-				node->debugDraw(draw_list, canvas_pos, index++);
+				if (i < size)
+				{
+					auto index = order[base + i].second;
+					const auto& rect = rects[index];
+					queries.index[i] = index;
+					queries.minX[i] = rect.x;
+					queries.minY[i] = rect.y;
+					queries.maxX[i] = rect.x + rect.width;
+					queries.maxY[i] = rect.y + rect.height;
+				}
+				else
+				{
+					// matches nothing
+					queries.minX[i] = queries.minY[i] = std::numeric_limits<float>::infinity();
+					queries.maxX[i] = queries.maxY[i] = -std::numeric_limits<float>::infinity();
+				}
 			}
+
+			auto live = size == BatchSize ? ~0ull : (1ull << size) - 1;
+			auto epoch = m_policy.storeStraddlersInParent ? 0 : scratch.nextEpoch(m_elements.size());
+			queryBatchNode(0, m_bounds, queries, live, 0, epoch, scratch, visitor);
 		}
 	}
 
-private:
+	template<typename Visitor>
+	void queryBatch(const std::vector<QuadRect>& rects, Visitor&& visitor) const
+	{
+		queryBatch(rects.data(), rects.size(), visitor, threadScratch());
+	}
 
-	void split()
+	template<typename Visitor>
+	void queryBatch(const std::vector<QuadRect>& rects, Visitor&& visitor, QueryScratch& scratch) const
 	{
-		auto nextLevel = this->m_level + 1;
-		auto subWidth = this->m_bounds.width / 2;
-		auto subHeight = this->m_bounds.height / 2;
-		auto x = this->m_bounds.x;
-		auto y = this->m_bounds.y;
+		queryBatch(rects.data(), rects.size(), visitor, scratch);
+	}
 
-		// top right
-		this->m_nodes[0] = std::make_unique<Quadtree>(QuadRect(x + subWidth, y, subWidth, subHeight), nextLevel);
-		// top left
-		this->m_nodes[1] = std::make_unique<Quadtree>(QuadRect(x, y, subWidth, subHeight), nextLevel);
-		// bottom left
-		this->m_nodes[2] = std::make_unique<Quadtree>(QuadRect(x, y + subHeight, subWidth, subHeight), nextLevel);
-		// bottom right
-		this->m_nodes[3] = std::make_unique<Quadtree>(QuadRect(x + subWidth, y + subHeight, subWidth, subHeight), nextLevel);
+	// Calls visitor(const T&) once for every object the circle around (x, y)
+	// touches. Nodes the circle misses are skipped and the contents of nodes
+	// inside the circle are reported without per-object tests.
+	template<typename Visitor>
+	void queryCircle(float x, float y, float radius, Visitor&& visitor) const
+	{
+		queryCircle(x, y, radius, visitor, threadScratch());
 	}
 
-	std::vector<int> getIndex(const QuadRect& rect)
+	template<typename Visitor>
+	void queryCircle(float x, float y, float radius, Visitor&& visitor, QueryScratch& scratch) const
 	{
-		std::vector<int> indexes;
-		auto verticalMidpoint = this->m_bounds.x + (this->m_bounds.width / 2);
-		auto horizontalMidpoint = this->m_bounds.y + (this->m_bounds.height / 2);
+		Circle circle = { x, y, radius, QuadRect(x - radius, y - radius, radius * 2, radius * 2) };
+		if (m_policy.storeStraddlersInParent)
+		{
+			auto emit = [this, &visitor](int32_t element)
+			{
+				visitor(m_elements[element].data);
+			};
+			queryCircleNode(0, m_bounds, circle, emit);
+			return;
+		}
 
-		auto startIsNorth = rect.y < horizontalMidpoint;
-		auto startIsWest = rect.x < verticalMidpoint;
-		auto endIsEast = rect.x + rect.width > verticalMidpoint;
-		auto endIsSouth = rect.y + rect.height > horizontalMidpoint;
+		auto epoch = scratch.nextEpoch(m_elements.size());
+		auto emit = [this, &visitor, &scratch, epoch](int32_t element)
+		{
+			if (scratch.visitStamps[element] != epoch)
+			{
+				scratch.visitStamps[element] = epoch;
+				visitor(m_elements[element].data);
+			}
+		};
+		queryCircleNode(0, m_bounds, circle, emit);
+	}
 
-		//top-right quad
-		if (startIsNorth && endIsEast) {
-			indexes.push_back(0);
+	// Calls visitor(const T&, float distance) for the k objects closest to
+	// (x, y), closest first. The distance is measured to the object bounds and
+	// is 0 for objects containing the point. Nodes and objects wait in one
+	// queue ordered by their distance to the point, so a node is only opened
+	// while it may still hold something closer than the objects found so far.
+	template<typename Visitor>
+	void nearest(float x, float y, uint32_t k, Visitor&& visitor) const
+	{
+		nearest(x, y, k, visitor, threadScratch());
+	}
+
+	template<typename Visitor>
+	void nearest(float x, float y, uint32_t k, Visitor&& visitor, QueryScratch& scratch) const
+	{
+		auto& queue = scratch.nearestQueue;
+		queue.clear();
+		if (k == 0)
+		{
+			return;
 		}
 
-		//top-left quad
-		if (startIsWest && startIsNorth) {
-			indexes.push_back(1);
+		auto deduplicate = !m_policy.storeStraddlersInParent;
+		auto epoch = deduplicate ? scratch.nextEpoch(m_elements.size()) : 0;
+		// objects the root could not grow around lie outside of their leaves,
+		// the distance to a node is no lower bound for its objects then
+		auto prune = m_outsideCount == 0;
+
+		queue.push_back({ 0.0f, 0, m_bounds });
+		while (!queue.empty())
+		{
+			std::pop_heap(queue.begin(), queue.end());
+			auto entry = queue.back();
+			queue.pop_back();
+
+			if (entry.index < 0)
+			{
+				visitor(m_elements[-1 - entry.index].data, std::sqrt(entry.distanceSq));
+				if (--k == 0)
+				{
+					break;
+				}
+				continue;
+			}
+
+			const auto& node = m_nodes[entry.index];
+			for (auto elementNode = node.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+			{
+				auto element = m_elementNodes[elementNode].element;
+				if (deduplicate)
+				{
+					if (scratch.visitStamps[element] == epoch)
+					{
+						continue;
+					}
+					scratch.visitStamps[element] = epoch;
+				}
+
+				queue.push_back({ distanceSqToRect(x, y, m_elements[element].bounds), -1 - element, QuadRect() });
+				std::push_heap(queue.begin(), queue.end());
+			}
+
+			if (node.firstChild != -1)
+			{
+				for (auto index = 0; index < 4; ++index)
+				{
+					auto childIndex = node.firstChild + index;
+					const auto& child = m_nodes[childIndex];
+					if (child.firstElement == -1 && child.firstChild == -1)
+					{
+						continue;
+					}
+					auto bounds = childBounds(entry.bounds, index);
+					queue.push_back({ prune ? distanceSqToRect(x, y, bounds) : 0.0f, childIndex, bounds });
+					std::push_heap(queue.begin(), queue.end());
+				}
+			}
 		}
+	}
 
-		//bottom-left quad
-		if (startIsWest && endIsSouth) {
-			indexes.push_back(2);
+	// Casts a ray from (x, y) along (dirX, dirY), which needn't be normalized,
+	// and returns the closest object whose bounds it enters within maxDistance,
+	// 0 if it starts inside. callback(const T&, float distance) is asked
+	// about every candidate closer than the best hit so far and returns false
+	// to let the ray pass through, e.g. for the caster itself. The children of
+	// a node are visited in the order the ray enters them, and a node entered
+	// behind the best hit is not visited at all.
+	template<typename Callback>
+	RayHit raycast(float x, float y, float dirX, float dirY, float maxDistance, Callback&& callback) const
+	{
+		return raycast(x, y, dirX, dirY, maxDistance, callback, threadScratch());
+	}
+
+	template<typename Callback>
+	RayHit raycast(float x, float y, float dirX, float dirY, float maxDistance, Callback&& callback, QueryScratch& scratch) const
+	{
+		RayHit hit = { T(), maxDistance, false };
+		auto length = std::sqrt(dirX * dirX + dirY * dirY);
+		if (!(length > 0.0f))
+		{
+			return hit;
 		}
 
-		//bottom-right quad
-		if (endIsEast && endIsSouth) {
-			indexes.push_back(3);
+		Ray ray = { x, y, dirX / length, dirY / length };
+		auto epoch = m_policy.storeStraddlersInParent ? 0 : scratch.nextEpoch(m_elements.size());
+		float entry;
+		if (m_outsideCount > 0 || rayEntry(ray, m_bounds, maxDistance, entry))
+		{
+			raycastNode(0, m_bounds, ray, epoch, scratch, callback, hit);
 		}
+		return hit;
+	}
 
-		return indexes;
+	// raycast limited to the segment between the two points
+	template<typename Callback>
+	RayHit segmentCast(float fromX, float fromY, float toX, float toY, Callback&& callback) const
+	{
+		return segmentCast(fromX, fromY, toX, toY, callback, threadScratch());
+	}
+
+	template<typename Callback>
+	RayHit segmentCast(float fromX, float fromY, float toX, float toY, Callback&& callback, QueryScratch& scratch) const
+	{
+		auto dirX = toX - fromX;
+		auto dirY = toY - fromY;
+		return raycast(fromX, fromY, dirX, dirY, std::sqrt(dirX * dirX + dirY * dirY), callback, scratch);
+	}
+
+	void clear()
+	{
+		this->m_nodes.clear();
+		this->m_elements.clear();
+		this->m_elementNodes.clear();
+		this->m_dirtyNodes.clear();
+		this->m_scratch.visitStamps.clear();
+		this->m_scratch.batchReported.clear();
+		this->m_scratch.epoch = 0;
+		this->m_outsideCount = 0;
+		this->m_objectCount = 0;
+		this->m_freeNode = -1;
+		this->m_freeElement = -1;
+		this->m_freeElementNode = -1;
+		this->m_packed = false;
+
+		this->m_nodes.push_back({ -1, -1, 0, 0, -1 });
+	}
+
+	void debugDraw(ImDrawList* draw_list, ImVec2 canvas_pos) const
+	{
+		debugDrawNode(0, m_bounds, draw_list, canvas_pos);
 	}
 
 private:
-	int m_level;
 
-	struct ObjectData
+	// hard depth limit, also the number of bits per axis of the morton codes
+	enum : uint32_t { MaxDepth = 16 };
+	enum : int32_t { LiveElement = -2 };
+	enum : uint32_t { BatchSize = 64 };
+	// objects per packedMask() call, a node's packed run starts on a multiple
+#if defined(QUADTREE_SIMD_AVX512)
+	enum : uint32_t { PackedLanes = 16 };
+#elif defined(QUADTREE_SIMD_AVX)
+	enum : uint32_t { PackedLanes = 8 };
+#elif defined(QUADTREE_SIMD_SSE2)
+	enum : uint32_t { PackedLanes = 4 };
+#else
+	enum : uint32_t { PackedLanes = 1 };
+#endif
+	typedef std::vector<float, QuadtreeAlignedAllocator<float, PackedLanes * sizeof(float)>> PackedFloats;
+	typedef std::vector<int32_t, QuadtreeAlignedAllocator<int32_t, PackedLanes * sizeof(int32_t)>> PackedElements;
+
+	struct Ray
 	{
-		QuadRect bounds;
-		T data;
+		float x;
+		float y;
+		// normalized
+		float dirX;
+		float dirY;
 	};
 
-	std::vector<ObjectData> m_objects;
-	std::array<std::unique_ptr<Quadtree>, 4> m_nodes;
-	QuadRect m_bounds;
+	struct Circle
+	{
+		float x;
+		float y;
+		float radius;
+		// bounding box, picks the children like a rect query
+		QuadRect box;
+	};
+
+	// one query per lane, padded with rects that match nothing
+	struct BatchQueries
+	{
+		alignas(32) float minX[BatchSize];
+		alignas(32) float minY[BatchSize];
+		alignas(32) float maxX[BatchSize];
+		alignas(32) float maxY[BatchSize];
+		// position of the lane's rect in the caller's array
+		uint32_t index[BatchSize];
+	};
+
+	// the split lines a node was reached through, infinite where the node
+	// borders the outside of the root
+	struct SplitLimits
+	{
+		float west;
+		float north;
+		float east;
+		float south;
+	};
+
+	struct BuildFrame
+	{
+		int32_t node;
+		QuadRect bounds;
+		SplitLimits limits;
+	};
+
+	struct DeferredLink
+	{
+		int32_t element;
+		int32_t node;
+		QuadRect bounds;
+	};
+
+	struct Node
+	{
+		// index of the first of the four children, -1 for a leaf
+		int32_t firstChild;
+		// head of the element node list, internal nodes only hold straddlers
+		int32_t firstElement;
+		uint32_t count : 31;
+		// queued in m_dirtyNodes
+		uint32_t dirty : 1;
+		// -1 for the root
+		int32_t parent;
+	};
+
+	struct ObjectData
+	{
+		QuadRect bounds;
+		T data;
+		// next free slot while the element is unused, LiveElement otherwise
+		int32_t nextFree;
+	};
+
+	struct ElementNode
+	{
+		int32_t next;
+		int32_t element;
+	};
+
+	// where buildNode puts what it creates, the tree itself or a thread's arena
+	struct BuildTarget
+	{
+		std::vector<Node>& nodes;
+		std::vector<ElementNode>& elementNodes;
+		std::vector<DeferredLink>& deferred;
+	};
+
+	struct BuildArena
+	{
+		std::vector<Node> nodes;
+		std::vector<ElementNode> elementNodes;
+		std::vector<DeferredLink> deferred;
+	};
+
+	int32_t allocElement(const QuadRect& rect, const T& data)
+	{
+		if (!containsRect(m_bounds, rect))
+		{
+			m_outsideCount++;
+		}
+		m_objectCount++;
+
+		if (m_freeElement != -1)
+		{
+			auto index = m_freeElement;
+			auto& obj = m_elements[index];
+			m_freeElement = obj.nextFree;
+			obj.bounds = rect;
+			obj.data = data;
+			obj.nextFree = LiveElement;
+			return index;
+		}
+		m_elements.push_back({ rect, data, LiveElement });
+		return static_cast<int32_t>(m_elements.size() - 1);
+	}
+
+	int32_t allocElementNode(int32_t element, int32_t next)
+	{
+		if (m_freeElementNode != -1)
+		{
+			auto index = m_freeElementNode;
+			m_freeElementNode = m_elementNodes[index].next;
+			m_elementNodes[index] = { next, element };
+			return index;
+		}
+		m_elementNodes.push_back({ next, element });
+		return static_cast<int32_t>(m_elementNodes.size() - 1);
+	}
+
+	void freeElementNode(int32_t index)
+	{
+		m_elementNodes[index].next = m_freeElementNode;
+		m_freeElementNode = index;
+	}
+
+	int32_t allocChildren(int32_t parent)
+	{
+		if (m_freeNode != -1)
+		{
+			auto index = m_freeNode;
+			m_freeNode = m_nodes[index].firstChild;
+			for (auto i = 0; i < 4; ++i)
+			{
+				m_nodes[index + i] = { -1, -1, 0, 0, parent };
+			}
+			return index;
+		}
+		auto index = static_cast<int32_t>(m_nodes.size());
+		for (auto i = 0; i < 4; ++i)
+		{
+			m_nodes.push_back({ -1, -1, 0, 0, parent });
+		}
+		return index;
+	}
+
+	void freeChildren(int32_t firstChild)
+	{
+		m_nodes[firstChild].firstChild = m_freeNode;
+		m_freeNode = firstChild;
+	}
+
+	// Doubles the root towards rect until rect fits. The old root moves into
+	// the quadrant of the new root it covers, which only touches the root and
+	// its direct children. Everything is relinked instead when objects outside
+	// of the old root were misplaced in its edge leaves, or when rounding
+	// would make the quadrant slightly differ from the old root.
+	void grow(const QuadRect& rect)
+	{
+		// doubling the smallest float reaches the largest in under 280 steps
+		const int MaxGrowSteps = 280;
+		auto relink = false;
+		for (int step = 0; step < MaxGrowSteps && !containsRect(m_bounds, rect) && canGrow(rect); ++step)
+		{
+			auto growWest = rect.x < m_bounds.x;
+			auto growNorth = rect.y < m_bounds.y;
+			QuadRect bounds(growWest ? m_bounds.x - m_bounds.width : m_bounds.x,
+				growNorth ? m_bounds.y - m_bounds.height : m_bounds.y,
+				m_bounds.width * 2, m_bounds.height * 2);
+
+			// the old root lies east when growing west and south when growing north
+			auto index = growNorth ? (growWest ? 3 : 2) : (growWest ? 0 : 1);
+			auto quadrant = childBounds(bounds, index);
+			if (m_outsideCount > 0 || quadrant.x != m_bounds.x || quadrant.y != m_bounds.y ||
+				quadrant.width != m_bounds.width || quadrant.height != m_bounds.height)
+			{
+				relink = true;
+			}
+			if (!relink)
+			{
+				adoptRoot(index);
+			}
+			m_bounds = bounds;
+		}
+
+		if (relink)
+		{
+			relinkAll();
+		}
+	}
+
+	bool canGrow(const QuadRect& rect) const
+	{
+		// non finite bounds could never be covered, they stay outside, and a
+		// root without area stays without it however often it doubles
+		return m_bounds.width > 0.0f && m_bounds.height > 0.0f && std::isfinite(rect.x) && std::isfinite(rect.y) && std::isfinite(rect.x + rect.width) && std::isfinite(rect.y + rect.height) &&
+			m_bounds.width < std::numeric_limits<float>::max() / 4 && m_bounds.height < std::numeric_limits<float>::max() / 4;
+	}
+
+	// moves the contents of the root into child index of a new child block
+	void adoptRoot(int32_t index)
+	{
+		if (m_nodes[0].firstChild == -1 && m_nodes[0].firstElement == -1)
+		{
+			return;
+		}
+
+		auto firstChild = allocChildren(0);
+		auto& root = m_nodes[0];
+		auto& child = m_nodes[firstChild + index];
+		child.firstChild = root.firstChild;
+		child.firstElement = root.firstElement;
+		child.count = root.count;
+		if (child.firstChild != -1)
+		{
+			for (auto i = 0; i < 4; ++i)
+			{
+				m_nodes[child.firstChild + i].parent = firstChild + index;
+			}
+		}
+		if (root.dirty)
+		{
+			root.dirty = 0;
+			child.dirty = 1;
+			std::replace(m_dirtyNodes.begin(), m_dirtyNodes.end(), 0, firstChild + index);
+		}
+
+		root.firstChild = firstChild;
+		root.firstElement = -1;
+		root.count = 0;
+	}
+
+	// drops all nodes and inserts the live objects again
+	void relinkAll()
+	{
+		m_nodes.clear();
+		m_elementNodes.clear();
+		m_dirtyNodes.clear();
+		m_freeNode = -1;
+		m_freeElementNode = -1;
+		m_outsideCount = 0;
+		m_nodes.push_back({ -1, -1, 0, 0, -1 });
+
+		for (int32_t element = 0; element < static_cast<int32_t>(m_elements.size()); ++element)
+		{
+			if (m_elements[element].nextFree == LiveElement)
+			{
+				if (!containsRect(m_bounds, m_elements[element].bounds))
+				{
+					m_outsideCount++;
+				}
+				insertElement(0, 0, m_bounds, element);
+			}
+		}
+	}
+
+	void markDirty(int32_t nodeIndex)
+	{
+		if (!m_nodes[nodeIndex].dirty)
+		{
+			m_nodes[nodeIndex].dirty = 1;
+			m_dirtyNodes.push_back(nodeIndex);
+		}
+	}
+
+	void unlinkElement(int32_t nodeIndex, const QuadRect& bounds, const QuadRect& rect, int32_t element)
+	{
+		auto firstChild = m_nodes[nodeIndex].firstChild;
+		if (firstChild != -1)
+		{
+			auto indexes = getIndex(bounds, rect);
+			if (!(m_policy.storeStraddlersInParent && isStraddling(indexes)))
+			{
+				for (auto index = 0; index < 4; ++index)
+				{
+					if (indexes & (1u << index))
+					{
+						unlinkElement(firstChild + index, childBounds(bounds, index), rect, element);
+					}
+				}
+				return;
+			}
+		}
+
+		auto& node = m_nodes[nodeIndex];
+		auto prev = -1;
+		for (auto elementNode = node.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+		{
+			if (m_elementNodes[elementNode].element == element)
+			{
+				if (prev == -1)
+				{
+					node.firstElement = m_elementNodes[elementNode].next;
+				}
+				else
+				{
+					m_elementNodes[prev].next = m_elementNodes[elementNode].next;
+				}
+				freeElementNode(elementNode);
+				node.count--;
+				break;
+			}
+			prev = elementNode;
+		}
+
+		if (firstChild != -1)
+		{
+			markDirty(nodeIndex);
+		}
+		else if (nodeIndex != 0)
+		{
+			markDirty(node.parent);
+		}
+	}
+
+	bool samePlacement(int32_t nodeIndex, const QuadRect& bounds, const QuadRect& oldRect, const QuadRect& newRect) const
+	{
+		auto firstChild = m_nodes[nodeIndex].firstChild;
+		if (firstChild == -1)
+		{
+			return true;
+		}
+
+		auto indexes = getIndex(bounds, oldRect);
+		if (indexes != getIndex(bounds, newRect))
+		{
+			return false;
+		}
+		if (m_policy.storeStraddlersInParent && isStraddling(indexes))
+		{
+			return true;
+		}
+
+		for (auto index = 0; index < 4; ++index)
+		{
+			if ((indexes & (1u << index)) && !samePlacement(firstChild + index, childBounds(bounds, index), oldRect, newRect))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool tryMerge(int32_t nodeIndex)
+	{
+		auto firstChild = m_nodes[nodeIndex].firstChild;
+		if (firstChild == -1)
+		{
+			return false;
+		}
+
+		// merge well below the split threshold so a single object moving back
+		// and forth does not split and merge the same node every frame
+		auto total = m_nodes[nodeIndex].count;
+		auto& stamps = m_scratch.visitStamps;
+		auto epoch = m_scratch.nextEpoch(m_elements.size());
+		for (auto index = 0; index < 4; ++index)
+		{
+			const auto& child = m_nodes[firstChild + index];
+			if (child.firstChild != -1)
+			{
+				return false;
+			}
+			for (auto elementNode = child.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+			{
+				auto element = m_elementNodes[elementNode].element;
+				if (stamps[element] != epoch)
+				{
+					stamps[element] = epoch;
+					total++;
+				}
+			}
+		}
+		if (total > m_policy.maxObjects / 2)
+		{
+			return false;
+		}
+
+		epoch = m_scratch.nextEpoch(m_elements.size());
+		auto& node = m_nodes[nodeIndex];
+		for (auto index = 0; index < 4; ++index)
+		{
+			auto elementNode = m_nodes[firstChild + index].firstElement;
+			while (elementNode != -1)
+			{
+				auto next = m_elementNodes[elementNode].next;
+				auto element = m_elementNodes[elementNode].element;
+				if (stamps[element] != epoch)
+				{
+					stamps[element] = epoch;
+					m_elementNodes[elementNode].next = node.firstElement;
+					node.firstElement = elementNode;
+				}
+				else
+				{
+					freeElementNode(elementNode);
+				}
+				elementNode = next;
+			}
+		}
+		node.firstChild = -1;
+		node.count = total;
+		freeChildren(firstChild);
+		return true;
+	}
+
+	void insertElement(int32_t nodeIndex, uint32_t level, const QuadRect& bounds, int32_t element)
+	{
+		if (m_nodes[nodeIndex].firstChild != -1)
+		{
+			auto firstChild = m_nodes[nodeIndex].firstChild;
+			auto indexes = getIndex(bounds, m_elements[element].bounds);
+			if (m_policy.storeStraddlersInParent && isStraddling(indexes))
+			{
+				auto& node = m_nodes[nodeIndex];
+				node.firstElement = allocElementNode(element, node.firstElement);
+				node.count++;
+				return;
+			}
+			for (auto index = 0; index < 4; ++index)
+			{
+				if (indexes & (1u << index))
+				{
+					insertElement(firstChild + index, level + 1, childBounds(bounds, index), element);
+				}
+			}
+			return;
+		}
+
+		auto& node = m_nodes[nodeIndex];
+		node.firstElement = allocElementNode(element, node.firstElement);
+		node.count++;
+
+		if (canSplit(level, node.count) && (!m_policy.adaptive || adaptiveSplit(nodeIndex, bounds)))
+		{
+			split(nodeIndex, level, bounds);
+		}
+	}
+
+	bool canSplit(uint32_t level, uint32_t count) const
+	{
+		if (count <= m_policy.maxObjects)
+		{
+			return false;
+		}
+		return level < (m_policy.adaptive ? static_cast<uint32_t>(MaxDepth) : std::min(m_policy.maxLevels, static_cast<uint32_t>(MaxDepth)));
+	}
+
+	// tallies where the objects of a full leaf would go if it was split
+	struct SplitCounter
+	{
+		uint32_t children[4];
+		uint32_t total;
+		// copied into all four children, or kept in the parent when
+		// storing straddlers there
+		uint32_t stuck;
+
+		void add(uint32_t indexes, bool storeStraddlersInParent)
+		{
+			total++;
+			if (storeStraddlersInParent ? isStraddling(indexes) : indexes == 0xf)
+			{
+				stuck++;
+				if (storeStraddlersInParent)
+				{
+					return;
+				}
+			}
+			for (auto index = 0; index < 4; ++index)
+			{
+				children[index] += (indexes >> index) & 1;
+			}
+		}
+
+		bool helps(uint32_t maxObjects) const
+		{
+			// stuck objects are in the way at every level below as well, so
+			// only the ones a split separates count against the capacity
+			if (stuck * 2 >= total || total - stuck <= maxObjects)
+			{
+				return false;
+			}
+			auto largest = std::max(std::max(children[0], children[1]), std::max(children[2], children[3]));
+			auto links = children[0] + children[1] + children[2] + children[3];
+			// moving everything into one child costs nothing and lets the
+			// next level separate a tight cluster
+			return largest < total || links == total;
+		}
+	};
+
+	bool adaptiveSplit(int32_t nodeIndex, const QuadRect& bounds) const
+	{
+		// a leaf that was not worth splitting is only looked at again once
+		// its size doubled, which keeps dense leaves from costing O(n) per insert
+		auto count = m_nodes[nodeIndex].count;
+		if (count != m_policy.maxObjects + 1 && (count & (count - 1)) != 0)
+		{
+			return false;
+		}
+
+		SplitCounter counter = {};
+		for (auto elementNode = m_nodes[nodeIndex].firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+		{
+			counter.add(getIndex(bounds, m_elements[m_elementNodes[elementNode].element].bounds), m_policy.storeStraddlersInParent);
+		}
+		return counter.helps(m_policy.maxObjects);
+	}
+
+	void collectStats(int32_t nodeIndex, uint32_t level, QuadtreeStats& stats) const
+	{
+		const auto& node = m_nodes[nodeIndex];
+		stats.nodeCount++;
+		stats.maxDepth = std::max(stats.maxDepth, level);
+		stats.linkCount += node.count;
+		if (node.firstChild == -1)
+		{
+			stats.leafCount++;
+			stats.maxLeafOccupancy = std::max(stats.maxLeafOccupancy, static_cast<uint32_t>(node.count));
+			return;
+		}
+		for (auto index = 0; index < 4; ++index)
+		{
+			collectStats(node.firstChild + index, level + 1, stats);
+		}
+	}
+
+	// LSD radix sort on the morton codes, stable for equal codes
+	void sortBuildOrder()
+	{
+		m_buildScratch.resize(m_buildOrder.size());
+		for (uint32_t shift = 0; shift < 32; shift += 8)
+		{
+			size_t offsets[256] = {};
+			for (const auto& entry : m_buildOrder)
+			{
+				offsets[(entry.first >> shift) & 0xff]++;
+			}
+			size_t sum = 0;
+			for (auto& offset : offsets)
+			{
+				auto count = offset;
+				offset = sum;
+				sum += count;
+			}
+			for (const auto& entry : m_buildOrder)
+			{
+				m_buildScratch[offsets[(entry.first >> shift) & 0xff]++] = entry;
+			}
+			m_buildOrder.swap(m_buildScratch);
+		}
+	}
+
+	void prepareBuild(const std::pair<QuadRect, T>* items, size_t count)
+	{
+		clear();
+
+		// the tree is empty, growing only moves the root bounds
+		for (size_t i = 0; i < count; ++i)
+		{
+			grow(items[i].first);
+		}
+
+		m_elements.reserve(count);
+		m_buildOrder.clear();
+		m_buildOrder.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto element = allocElement(items[i].first, items[i].second);
+			m_buildOrder.push_back({ mortonCode(items[i].first), element });
+		}
+		sortBuildOrder();
+		m_buildDeferred.clear();
+	}
+
+	BuildFrame rootFrame() const
+	{
+		const float inf = std::numeric_limits<float>::infinity();
+		return { 0, m_bounds, { -inf, -inf, inf, inf } };
+	}
+
+	void linkDeferred()
+	{
+		for (const auto& deferred : m_buildDeferred)
+		{
+			linkElement(deferred.node, deferred.bounds, deferred.element);
+		}
+	}
+
+	bool buildSplits(const QuadRect& bounds, uint32_t level, size_t begin, size_t end) const
+	{
+		if (!canSplit(level, static_cast<uint32_t>(end - begin)))
+		{
+			return false;
+		}
+		if (!m_policy.adaptive)
+		{
+			return true;
+		}
+		SplitCounter counter = {};
+		for (auto i = begin; i < end; ++i)
+		{
+			counter.add(getIndex(bounds, m_elements[m_buildOrder[i].second].bounds), m_policy.storeStraddlersInParent);
+		}
+		return counter.helps(m_policy.maxObjects);
+	}
+
+	// ranges[digit]..ranges[digit + 1] is the part of begin..end in the child
+	// of that morton digit, the range is sorted so the digit only grows
+	void splitBuildRange(uint32_t level, size_t begin, size_t end, size_t* ranges) const
+	{
+		auto shift = 2 * (MaxDepth - 1 - level);
+		ranges[0] = begin;
+		for (uint32_t digit = 0; digit < 4; ++digit)
+		{
+			auto last = ranges[digit];
+			while (last < end && ((m_buildOrder[last].first >> shift) & 3) == digit)
+			{
+				++last;
+			}
+			ranges[digit + 1] = last;
+		}
+	}
+
+	// bounds and split limits of path[level + 1], the node index is up to the caller
+	static void setChildFrame(BuildFrame* path, uint32_t level, uint32_t digit)
+	{
+		const auto& frame = path[level];
+		auto verticalMidpoint = frame.bounds.x + (frame.bounds.width / 2);
+		auto horizontalMidpoint = frame.bounds.y + (frame.bounds.height / 2);
+
+		auto& childFrame = path[level + 1];
+		childFrame.bounds = childBounds(frame.bounds, childFromMortonDigit(digit));
+		childFrame.limits = frame.limits;
+		if (digit & 1)
+			childFrame.limits.west = verticalMidpoint;
+		else
+			childFrame.limits.east = verticalMidpoint;
+		if (digit & 2)
+			childFrame.limits.north = horizontalMidpoint;
+		else
+			childFrame.limits.south = horizontalMidpoint;
+	}
+
+	// path[level] is the node being built, path[0..level) its ancestors
+	void buildNode(BuildTarget& target, BuildFrame* path, uint32_t level, size_t begin, size_t end)
+	{
+		const auto& frame = path[level];
+		if (!buildSplits(frame.bounds, level, begin, end))
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				auto element = m_buildOrder[i].second;
+				const auto& rect = m_elements[element].bounds;
+				if (fitsLimits(rect, frame.limits))
+				{
+					auto& node = target.nodes[frame.node];
+					target.elementNodes.push_back({ node.firstElement, element });
+					node.firstElement = static_cast<int32_t>(target.elementNodes.size() - 1);
+					node.count++;
+					continue;
+				}
+
+				// the root has no limits, only non-finite bounds fit nowhere and
+				// stay at the root
+				auto ancestor = level;
+				while (ancestor > 0 && !fitsLimits(rect, path[--ancestor].limits))
+				{
+				}
+				target.deferred.push_back({ element, path[ancestor].node, path[ancestor].bounds });
+			}
+			return;
+		}
+
+		// the tree was cleared, there are no free nodes to reuse
+		auto firstChild = static_cast<int32_t>(target.nodes.size());
+		for (auto i = 0; i < 4; ++i)
+		{
+			target.nodes.push_back({ -1, -1, 0, 0, frame.node });
+		}
+		target.nodes[frame.node].firstChild = firstChild;
+
+		size_t ranges[5];
+		splitBuildRange(level, begin, end, ranges);
+		for (uint32_t digit = 0; digit < 4; ++digit)
+		{
+			setChildFrame(path, level, digit);
+			path[level + 1].node = firstChild + childFromMortonDigit(digit);
+			buildNode(target, path, level + 1, ranges[digit], ranges[digit + 1]);
+		}
+	}
+
+	// appends the nodes of a subtree built by buildParallel, local node 0 is
+	// the root and local node 1 goes to subtreeRoot
+	void stitchArena(const BuildArena& arena, int32_t subtreeRoot)
+	{
+		auto nodeBase = static_cast<int32_t>(m_nodes.size()) - 2;
+		auto elementBase = static_cast<int32_t>(m_elementNodes.size());
+		auto mapNode = [nodeBase, subtreeRoot](int32_t local)
+		{
+			return local <= 0 ? local : (local == 1 ? subtreeRoot : local + nodeBase);
+		};
+		auto mapElement = [elementBase](int32_t local)
+		{
+			return local == -1 ? -1 : local + elementBase;
+		};
+
+		m_nodes.reserve(m_nodes.size() + arena.nodes.size() - 2);
+		for (size_t i = 1; i < arena.nodes.size(); ++i)
+		{
+			auto node = arena.nodes[i];
+			node.firstChild = mapNode(node.firstChild);
+			node.firstElement = mapElement(node.firstElement);
+			node.parent = mapNode(node.parent);
+			if (i == 1)
+			{
+				m_nodes[subtreeRoot] = node;
+			}
+			else
+			{
+				m_nodes.push_back(node);
+			}
+		}
+
+		m_elementNodes.reserve(m_elementNodes.size() + arena.elementNodes.size());
+		for (const auto& elementNode : arena.elementNodes)
+		{
+			m_elementNodes.push_back({ mapElement(elementNode.next), elementNode.element });
+		}
+
+		for (const auto& deferred : arena.deferred)
+		{
+			m_buildDeferred.push_back({ deferred.element, mapNode(deferred.node), deferred.bounds });
+		}
+	}
+
+	// true when getIndex would send rect into a single child at every split
+	static bool fitsLimits(const QuadRect& rect, const SplitLimits& limits)
+	{
+		return rect.x >= limits.west && rect.x + rect.width <= limits.east && rect.x < limits.east &&
+			rect.y >= limits.north && rect.y + rect.height <= limits.south && rect.y < limits.south;
+	}
+
+	// insertElement without splitting, the layout is already final
+	void linkElement(int32_t nodeIndex, const QuadRect& bounds, int32_t element)
+	{
+		auto firstChild = m_nodes[nodeIndex].firstChild;
+		if (firstChild != -1)
+		{
+			auto indexes = getIndex(bounds, m_elements[element].bounds);
+			if (!(m_policy.storeStraddlersInParent && isStraddling(indexes)))
+			{
+				for (auto index = 0; index < 4; ++index)
+				{
+					if (indexes & (1u << index))
+					{
+						linkElement(firstChild + index, childBounds(bounds, index), element);
+					}
+				}
+				return;
+			}
+		}
+
+		auto& node = m_nodes[nodeIndex];
+		node.firstElement = allocElementNode(element, node.firstElement);
+		node.count++;
+	}
+
+	static uint32_t spreadBits(uint32_t v)
+	{
+		v &= 0xffff;
+		v = (v | (v << 8)) & 0x00ff00ff;
+		v = (v | (v << 4)) & 0x0f0f0f0f;
+		v = (v | (v << 2)) & 0x33333333;
+		v = (v | (v << 1)) & 0x55555555;
+		return v;
+	}
+
+	// x in the even bits, y in the odd bits, quantized to the root bounds
+	uint32_t mortonCode(const QuadRect& rect) const
+	{
+		const float scale = static_cast<float>(1u << MaxDepth);
+		auto fx = (rect.x + rect.width * 0.5f - m_bounds.x) / m_bounds.width * scale;
+		auto fy = (rect.y + rect.height * 0.5f - m_bounds.y) / m_bounds.height * scale;
+		// written so that NaN ends up at 0
+		auto ix = fx > 0.0f ? static_cast<uint32_t>(std::min(fx, scale - 1.0f)) : 0u;
+		auto iy = fy > 0.0f ? static_cast<uint32_t>(std::min(fy, scale - 1.0f)) : 0u;
+		return spreadBits(ix) | (spreadBits(iy) << 1);
+	}
+
+	static int childFromMortonDigit(uint32_t digit)
+	{
+		// digit bit 0 is east, bit 1 is south
+		static const int children[4] = { 1, 0, 2, 3 };
+		return children[digit];
+	}
+
+	void split(int32_t nodeIndex, uint32_t level, const QuadRect& bounds)
+	{
+		auto firstChild = allocChildren(nodeIndex);
+
+		auto& node = m_nodes[nodeIndex];
+		auto elementNode = node.firstElement;
+		node.firstChild = firstChild;
+		node.firstElement = -1;
+		node.count = 0;
+
+		while (elementNode != -1)
+		{
+			auto next = m_elementNodes[elementNode].next;
+			auto element = m_elementNodes[elementNode].element;
+
+			auto indexes = getIndex(bounds, m_elements[element].bounds);
+			if (m_policy.storeStraddlersInParent && isStraddling(indexes))
+			{
+				auto& parent = m_nodes[nodeIndex];
+				m_elementNodes[elementNode].next = parent.firstElement;
+				parent.firstElement = elementNode;
+				parent.count++;
+				elementNode = next;
+				continue;
+			}
+
+			freeElementNode(elementNode);
+			for (auto index = 0; index < 4; ++index)
+			{
+				if (indexes & (1u << index))
+				{
+					insertElement(firstChild + index, level + 1, childBounds(bounds, index), element);
+				}
+			}
+			elementNode = next;
+		}
+	}
+
+	template<typename Visitor>
+	void retrieveNode(int32_t nodeIndex, const QuadRect& bounds, const QuadRect& rect, Visitor& visitor) const
+	{
+		const auto& node = m_nodes[nodeIndex];
+		for (auto elementNode = node.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+		{
+			visitor(m_elementNodes[elementNode].element);
+		}
+
+		if (node.firstChild != -1)
+		{
+			auto firstChild = node.firstChild;
+			auto indexes = getIndex(bounds, rect);
+			for (auto index = 0; index < 4; ++index)
+			{
+				if (indexes & (1u << index))
+				{
+					retrieveNode(firstChild + index, childBounds(bounds, index), rect, visitor);
+				}
+			}
+		}
+	}
+
+	template<typename Emit>
+	void queryNode(int32_t nodeIndex, const QuadRect& bounds, const QuadRect& rect, Emit& emit) const
+	{
+		// objects the root could not grow around sit in the edge leaves without
+		// overlapping them, so bulk reporting is only exact while there are none
+		if (m_outsideCount == 0 && containsRect(rect, bounds))
+		{
+			emitSubtree(nodeIndex, emit);
+			return;
+		}
+
+		const auto& node = m_nodes[nodeIndex];
+		if (m_packed)
+		{
+			queryPacked(nodeIndex, rect, emit);
+		}
+		else
+		{
+			for (auto elementNode = node.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+			{
+				auto element = m_elementNodes[elementNode].element;
+				if (overlapsRect(m_elements[element].bounds, rect))
+				{
+					emit(element);
+				}
+			}
+		}
+
+		if (node.firstChild != -1)
+		{
+			auto firstChild = node.firstChild;
+			auto indexes = getOverlapIndex(bounds, rect);
+			for (auto index = 0; index < 4; ++index)
+			{
+				if (indexes & (1u << index))
+				{
+					queryNode(firstChild + index, childBounds(bounds, index), rect, emit);
+				}
+			}
+		}
+	}
+
+	// compact() put the bounds and elements of the node's objects back to back
+	// in the packed arrays, from m_packedFirst on
+	template<typename Emit>
+	void queryPacked(int32_t nodeIndex, const QuadRect& rect, Emit& emit) const
+	{
+		auto begin = m_packedFirst[nodeIndex];
+		auto end = begin + m_nodes[nodeIndex].count;
+		for (auto first = begin; first < end; first += PackedLanes)
+		{
+			auto hits = packedMask(first, rect);
+			if (end - first < PackedLanes)
+			{
+				hits &= (1u << (end - first)) - 1;
+			}
+			for (; hits; hits &= hits - 1)
+			{
+				emit(m_packedElement[first + lowestBit(hits)]);
+			}
+		}
+	}
+
+	// fills the last lane group of the packed arrays, the padding matches no
+	// rect and keeps the next node's run on a vector boundary
+	void padPacked()
+	{
+		const float inf = std::numeric_limits<float>::infinity();
+		while (m_packedElement.size() % PackedLanes != 0)
+		{
+			m_packedMinX.push_back(inf);
+			m_packedMinY.push_back(inf);
+			m_packedMaxX.push_back(-inf);
+			m_packedMaxY.push_back(-inf);
+			m_packedElement.push_back(-1);
+		}
+	}
+
+	template<typename Emit>
+	void queryCircleNode(int32_t nodeIndex, const QuadRect& bounds, const Circle& circle, Emit& emit) const
+	{
+		// same as queryNode, nodes only bound their objects without outsiders
+		if (m_outsideCount == 0)
+		{
+			if (!touchesCircle(bounds, circle))
+			{
+				return;
+			}
+			if (CircleContainsBox(circle.x, circle.y, circle.radius, bounds.x + bounds.width * 0.5f, bounds.y + bounds.height * 0.5f, bounds.width, bounds.height))
+			{
+				emitSubtree(nodeIndex, emit);
+				return;
+			}
+		}
+
+		const auto& node = m_nodes[nodeIndex];
+		for (auto elementNode = node.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+		{
+			auto element = m_elementNodes[elementNode].element;
+			if (touchesCircle(m_elements[element].bounds, circle))
+			{
+				emit(element);
+			}
+		}
+
+		if (node.firstChild != -1)
+		{
+			auto firstChild = node.firstChild;
+			auto indexes = getOverlapIndex(bounds, circle.box);
+			for (auto index = 0; index < 4; ++index)
+			{
+				if (indexes & (1u << index))
+				{
+					queryCircleNode(firstChild + index, childBounds(bounds, index), circle, emit);
+				}
+			}
+		}
+	}
+
+	template<typename Callback>
+	void raycastNode(int32_t nodeIndex, const QuadRect& bounds, const Ray& ray, uint32_t epoch, QueryScratch& scratch, Callback& callback, RayHit& hit) const
+	{
+		const auto& node = m_nodes[nodeIndex];
+		for (auto elementNode = node.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+		{
+			auto element = m_elementNodes[elementNode].element;
+			if (epoch != 0)
+			{
+				// the best distance only shrinks, a second look cannot change the outcome
+				if (scratch.visitStamps[element] == epoch)
+				{
+					continue;
+				}
+				scratch.visitStamps[element] = epoch;
+			}
+
+			const auto& obj = m_elements[element];
+			float distance;
+			if (rayEntry(ray, obj.bounds, hit.distance, distance) && callback(obj.data, distance))
+			{
+				hit.data = obj.data;
+				hit.distance = distance;
+				hit.hit = true;
+			}
+		}
+
+		if (node.firstChild == -1)
+		{
+			return;
+		}
+
+		// children the ray reaches, sorted by entry distance; every object
+		// overlaps a node it is linked to, so the ray meets it no earlier than
+		// that node unless the root could not grow around some object
+		auto prune = m_outsideCount == 0;
+		std::pair<float, int32_t> order[4];
+		auto count = 0;
+		for (auto index = 0; index < 4; ++index)
+		{
+			const auto& child = m_nodes[node.firstChild + index];
+			if (child.firstElement == -1 && child.firstChild == -1)
+			{
+				continue;
+			}
+			float entry = 0.0f;
+			if (prune && !rayEntry(ray, childBounds(bounds, index), hit.distance, entry))
+			{
+				continue;
+			}
+			auto slot = count++;
+			for (; slot > 0 && order[slot - 1].first > entry; --slot)
+			{
+				order[slot] = order[slot - 1];
+			}
+			order[slot] = { entry, index };
+		}
+
+		for (auto i = 0; i < count; ++i)
+		{
+			// hit.distance shrinks while the earlier children are walked
+			if (prune && order[i].first > hit.distance)
+			{
+				break;
+			}
+			auto index = order[i].second;
+			raycastNode(node.firstChild + index, childBounds(bounds, index), ray, epoch, scratch, callback, hit);
+		}
+	}
+
+	template<typename Emit>
+	void emitSubtree(int32_t nodeIndex, Emit& emit) const
+	{
+		const auto& node = m_nodes[nodeIndex];
+		for (auto elementNode = node.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+		{
+			emit(m_elementNodes[elementNode].element);
+		}
+
+		if (node.firstChild != -1)
+		{
+			for (auto index = 0; index < 4; ++index)
+			{
+				emitSubtree(node.firstChild + index, emit);
+			}
+		}
+	}
+
+	// test holds the queries that overlap the node and still test its objects,
+	// contained the ones that fully contain it and take everything below
+	template<typename Visitor>
+	void queryBatchNode(int32_t nodeIndex, const QuadRect& bounds, const BatchQueries& queries, uint64_t test, uint64_t contained, uint32_t epoch, QueryScratch& scratch, Visitor& visitor) const
+	{
+		const auto& node = m_nodes[nodeIndex];
+		for (auto elementNode = node.firstElement; elementNode != -1; elementNode = m_elementNodes[elementNode].next)
+		{
+			auto element = m_elementNodes[elementNode].element;
+			const auto& rect = m_elements[element].bounds;
+			auto hits = contained;
+			if (test)
+			{
+				hits |= batchMask(queries, rect.x + rect.width, rect.x, rect.y + rect.height, rect.y, test);
+			}
+
+			if (!m_policy.storeStraddlersInParent)
+			{
+				// a copy in another leaf may have been reported to some of them
+				if (scratch.visitStamps[element] != epoch)
+				{
+					scratch.visitStamps[element] = epoch;
+					scratch.batchReported[element] = 0;
+				}
+				hits &= ~scratch.batchReported[element];
+				scratch.batchReported[element] |= hits;
+			}
+
+			while (hits)
+			{
+				visitor(static_cast<size_t>(queries.index[lowestBit(hits)]), m_elements[element].data);
+				hits &= hits - 1;
+			}
+		}
+
+		if (node.firstChild == -1)
+		{
+			return;
+		}
+
+		uint64_t sides[4] = {};
+		if (test)
+		{
+			batchSides(queries, bounds.x + (bounds.width / 2), bounds.y + (bounds.height / 2), test, sides);
+		}
+		const uint64_t childTests[4] = { sides[2] & sides[1], sides[2] & sides[0], sides[3] & sides[0], sides[3] & sides[1] };
+
+		for (auto index = 0; index < 4; ++index)
+		{
+			auto childTest = childTests[index];
+			if (!(childTest | contained))
+			{
+				continue;
+			}
+			auto child = childBounds(bounds, index);
+			auto childContained = contained;
+			if (childTest && m_outsideCount == 0)
+			{
+				auto inside = batchMask(queries, child.x, child.x + child.width, child.y, child.y + child.height, childTest);
+				childContained |= inside;
+				childTest &= ~inside;
+			}
+			queryBatchNode(node.firstChild + index, child, queries, childTest, childContained, epoch, scratch, visitor);
+		}
+	}
+
+	// bit i set for the live lanes with minX <= west, maxX >= east,
+	// minY <= north and maxY >= south
+	static uint64_t batchMask(const BatchQueries& queries, float west, float east, float north, float south, uint64_t live)
+	{
+		uint64_t bits = 0;
+#if defined(QUADTREE_SIMD_AVX)
+		auto w = _mm256_set1_ps(west);
+		auto e = _mm256_set1_ps(east);
+		auto n = _mm256_set1_ps(north);
+		auto s = _mm256_set1_ps(south);
+		for (uint32_t base = 0; base < BatchSize; base += 8)
+		{
+			if (((live >> base) & 0xff) == 0)
+			{
+				continue;
+			}
+			auto x = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(queries.minX + base), w, _CMP_LE_OQ), _mm256_cmp_ps(_mm256_load_ps(queries.maxX + base), e, _CMP_GE_OQ));
+			auto y = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(queries.minY + base), n, _CMP_LE_OQ), _mm256_cmp_ps(_mm256_load_ps(queries.maxY + base), s, _CMP_GE_OQ));
+			bits |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_and_ps(x, y))) << base;
+		}
+#elif defined(QUADTREE_SIMD_SSE2)
+		auto w = _mm_set1_ps(west);
+		auto e = _mm_set1_ps(east);
+		auto n = _mm_set1_ps(north);
+		auto s = _mm_set1_ps(south);
+		for (uint32_t base = 0; base < BatchSize; base += 4)
+		{
+			if (((live >> base) & 0xf) == 0)
+			{
+				continue;
+			}
+			auto x = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(queries.minX + base), w), _mm_cmpge_ps(_mm_load_ps(queries.maxX + base), e));
+			auto y = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(queries.minY + base), n), _mm_cmpge_ps(_mm_load_ps(queries.maxY + base), s));
+			bits |= static_cast<uint64_t>(_mm_movemask_ps(_mm_and_ps(x, y))) << base;
+		}
+#else
+		for (auto lanes = live; lanes; lanes &= lanes - 1)
+		{
+			auto i = lowestBit(lanes);
+			if (queries.minX[i] <= west && queries.maxX[i] >= east && queries.minY[i] <= north && queries.maxY[i] >= south)
+			{
+				bits |= 1ull << i;
+			}
+		}
+#endif
+		return bits & live;
+	}
+
+	// bit i set when packed object first + i overlaps rect, the negated form of
+	// overlapsRect so NaN bounds behave the same
+	uint32_t packedMask(uint32_t first, const QuadRect& rect) const
+	{
+		auto right = rect.x + rect.width;
+		auto bottom = rect.y + rect.height;
+#if defined(QUADTREE_SIMD_AVX512)
+		auto misses = _mm512_cmp_ps_mask(_mm512_load_ps(m_packedMaxX.data() + first), _mm512_set1_ps(rect.x), _CMP_LT_OQ) |
+			_mm512_cmp_ps_mask(_mm512_set1_ps(right), _mm512_load_ps(m_packedMinX.data() + first), _CMP_LT_OQ) |
+			_mm512_cmp_ps_mask(_mm512_load_ps(m_packedMaxY.data() + first), _mm512_set1_ps(rect.y), _CMP_LT_OQ) |
+			_mm512_cmp_ps_mask(_mm512_set1_ps(bottom), _mm512_load_ps(m_packedMinY.data() + first), _CMP_LT_OQ);
+		return ~static_cast<uint32_t>(misses) & 0xffffu;
+#elif defined(QUADTREE_SIMD_AVX)
+		auto x = _mm256_or_ps(_mm256_cmp_ps(_mm256_load_ps(m_packedMaxX.data() + first), _mm256_set1_ps(rect.x), _CMP_LT_OQ),
+			_mm256_cmp_ps(_mm256_set1_ps(right), _mm256_load_ps(m_packedMinX.data() + first), _CMP_LT_OQ));
+		auto y = _mm256_or_ps(_mm256_cmp_ps(_mm256_load_ps(m_packedMaxY.data() + first), _mm256_set1_ps(rect.y), _CMP_LT_OQ),
+			_mm256_cmp_ps(_mm256_set1_ps(bottom), _mm256_load_ps(m_packedMinY.data() + first), _CMP_LT_OQ));
+		return ~static_cast<uint32_t>(_mm256_movemask_ps(_mm256_or_ps(x, y))) & 0xffu;
+#elif defined(QUADTREE_SIMD_SSE2)
+		auto x = _mm_or_ps(_mm_cmplt_ps(_mm_load_ps(m_packedMaxX.data() + first), _mm_set1_ps(rect.x)),
+			_mm_cmplt_ps(_mm_set1_ps(right), _mm_load_ps(m_packedMinX.data() + first)));
+		auto y = _mm_or_ps(_mm_cmplt_ps(_mm_load_ps(m_packedMaxY.data() + first), _mm_set1_ps(rect.y)),
+			_mm_cmplt_ps(_mm_set1_ps(bottom), _mm_load_ps(m_packedMinY.data() + first)));
+		return ~static_cast<uint32_t>(_mm_movemask_ps(_mm_or_ps(x, y))) & 0xfu;
+#else
+		return !(m_packedMaxX[first] < rect.x || right < m_packedMinX[first] ||
+			m_packedMaxY[first] < rect.y || bottom < m_packedMinY[first]) ? 1u : 0u;
+#endif
+	}
+
+	// the lanes reaching west, east, north and south of the midpoints, same
+	// rules as getOverlapIndex
+	static void batchSides(const BatchQueries& queries, float verticalMidpoint, float horizontalMidpoint, uint64_t live, uint64_t* sides)
+	{
+#if defined(QUADTREE_SIMD_AVX)
+		auto vm = _mm256_set1_ps(verticalMidpoint);
+		auto hm = _mm256_set1_ps(horizontalMidpoint);
+		for (uint32_t base = 0; base < BatchSize; base += 8)
+		{
+			if (((live >> base) & 0xff) == 0)
+			{
+				continue;
+			}
+			sides[0] |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(queries.minX + base), vm, _CMP_LE_OQ))) << base;
+			sides[1] |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(queries.maxX + base), vm, _CMP_GE_OQ))) << base;
+			sides[2] |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(queries.minY + base), hm, _CMP_LE_OQ))) << base;
+			sides[3] |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(queries.maxY + base), hm, _CMP_GE_OQ))) << base;
+		}
+#elif defined(QUADTREE_SIMD_SSE2)
+		auto vm = _mm_set1_ps(verticalMidpoint);
+		auto hm = _mm_set1_ps(horizontalMidpoint);
+		for (uint32_t base = 0; base < BatchSize; base += 4)
+		{
+			if (((live >> base) & 0xf) == 0)
+			{
+				continue;
+			}
+			sides[0] |= static_cast<uint64_t>(_mm_movemask_ps(_mm_cmple_ps(_mm_load_ps(queries.minX + base), vm))) << base;
+			sides[1] |= static_cast<uint64_t>(_mm_movemask_ps(_mm_cmpge_ps(_mm_load_ps(queries.maxX + base), vm))) << base;
+			sides[2] |= static_cast<uint64_t>(_mm_movemask_ps(_mm_cmple_ps(_mm_load_ps(queries.minY + base), hm))) << base;
+			sides[3] |= static_cast<uint64_t>(_mm_movemask_ps(_mm_cmpge_ps(_mm_load_ps(queries.maxY + base), hm))) << base;
+		}
+#else
+		for (auto lanes = live; lanes; lanes &= lanes - 1)
+		{
+			auto i = lowestBit(lanes);
+			auto bit = 1ull << i;
+			sides[0] |= queries.minX[i] <= verticalMidpoint ? bit : 0;
+			sides[1] |= queries.maxX[i] >= verticalMidpoint ? bit : 0;
+			sides[2] |= queries.minY[i] <= horizontalMidpoint ? bit : 0;
+			sides[3] |= queries.maxY[i] >= horizontalMidpoint ? bit : 0;
+		}
+#endif
+		for (auto i = 0; i < 4; ++i)
+		{
+			sides[i] &= live;
+		}
+	}
+
+	static uint32_t lowestBit(uint64_t bits)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return index;
+#elif defined(_MSC_VER)
+		unsigned long index;
+		if (_BitScanForward(&index, static_cast<unsigned long>(bits)))
+		{
+			return index;
+		}
+		_BitScanForward(&index, static_cast<unsigned long>(bits >> 32));
+		return index + 32;
+#else
+		return static_cast<uint32_t>(__builtin_ctzll(bits));
+#endif
+	}
+
+	void debugDrawNode(int32_t nodeIndex, const QuadRect& bounds, ImDrawList* draw_list, ImVec2 canvas_pos) const
+	{
+		const float offset_value = 0.5f;
+
+		ImVec2 v[4];
+		v[0].x = bounds.x + canvas_pos.x + offset_value;
+		v[0].y = bounds.y + canvas_pos.y + offset_value;
+
+		v[1].x = bounds.x + canvas_pos.x + offset_value;
+		v[1].y = bounds.y + canvas_pos.y + bounds.height - offset_value;
+
+		v[2].x = bounds.x + canvas_pos.x + bounds.width - offset_value;
+		v[2].y = bounds.y + canvas_pos.y + bounds.height - offset_value;
+
+		v[3].x = bounds.x + canvas_pos.x + bounds.width - offset_value;
+		v[3].y = bounds.y + canvas_pos.y + offset_value;
+
+		draw_list->AddPolyline(v, 4, IM_COL32(0, 200, 200, 255), true, 0.0f);
+
+		auto firstChild = m_nodes[nodeIndex].firstChild;
+		if (firstChild != -1)
+		{
+			for (auto index = 0; index < 4; ++index)
+			{
+				debugDrawNode(firstChild + index, childBounds(bounds, index), draw_list, canvas_pos);
+			}
+		}
+	}
+
+	static QuadRect childBounds(const QuadRect& bounds, int index)
+	{
+		auto subWidth = bounds.width / 2;
+		auto subHeight = bounds.height / 2;
+		auto x = bounds.x;
+		auto y = bounds.y;
+
+		switch (index)
+		{
+		// top right
+		case 0: return QuadRect(x + subWidth, y, subWidth, subHeight);
+		// top left
+		case 1: return QuadRect(x, y, subWidth, subHeight);
+		// bottom left
+		case 2: return QuadRect(x, y + subHeight, subWidth, subHeight);
+		// bottom right
+		default: return QuadRect(x + subWidth, y + subHeight, subWidth, subHeight);
+		}
+	}
+
+	// a handle insert returned that wasn't removed since
+	bool isLive(Handle handle) const
+	{
+		return handle >= 0 && static_cast<size_t>(handle) < m_elements.size() && m_elements[handle].nextFree == LiveElement;
+	}
+
+	// The scratch of the overloads without one. Its epoch only counts up, so
+	// stamps another tree left in it never match a new query.
+	static QueryScratch& threadScratch()
+	{
+		static thread_local QueryScratch scratch;
+		return scratch;
+	}
+
+	static bool containsRect(const QuadRect& outer, const QuadRect& inner)
+	{
+		return outer.x <= inner.x && inner.x + inner.width <= outer.x + outer.width &&
+			outer.y <= inner.y && inner.y + inner.height <= outer.y + outer.height;
+	}
+
+	static bool overlapsRect(const QuadRect& a, const QuadRect& b)
+	{
+		return !(a.x + a.width < b.x || b.x + b.width < a.x ||
+			a.y + a.height < b.y || b.y + b.height < a.y);
+	}
+
+	static bool touchesCircle(const QuadRect& rect, const Circle& circle)
+	{
+		return CircleToBox(circle.x, circle.y, circle.radius, rect.x + rect.width * 0.5f, rect.y + rect.height * 0.5f, rect.width, rect.height);
+	}
+
+	// slab test, distance at which the ray enters rect if that is within
+	// maxDistance, touching counts
+	static bool rayEntry(const Ray& ray, const QuadRect& rect, float maxDistance, float& entry)
+	{
+		auto enter = 0.0f;
+		auto leave = maxDistance;
+		if (!raySlab(ray.x, ray.dirX, rect.x, rect.x + rect.width, enter, leave) ||
+			!raySlab(ray.y, ray.dirY, rect.y, rect.y + rect.height, enter, leave))
+		{
+			return false;
+		}
+		entry = enter;
+		return true;
+	}
+
+	static bool raySlab(float origin, float dir, float low, float high, float& enter, float& leave)
+	{
+		if (dir == 0.0f)
+		{
+			// parallel, the reciprocal would turn an origin on the border into NaN
+			return origin >= low && origin <= high;
+		}
+		auto inverse = 1.0f / dir;
+		auto t0 = (low - origin) * inverse;
+		auto t1 = (high - origin) * inverse;
+		if (t0 > t1)
+		{
+			std::swap(t0, t1);
+		}
+		enter = std::max(enter, t0);
+		leave = std::min(leave, t1);
+		return enter <= leave;
+	}
+
+	static float distanceSqToRect(float x, float y, const QuadRect& rect)
+	{
+		return PointToBoxDistanceSq(x, y, rect.x + rect.width * 0.5f, rect.y + rect.height * 0.5f, rect.width, rect.height);
+	}
+
+	static bool isStraddling(uint32_t indexes)
+	{
+		// more than one quadrant bit set
+		return (indexes & (indexes - 1)) != 0;
+	}
+
+	// bit i set means the rect overlaps child quadrant i
+	static uint32_t getIndex(const QuadRect& bounds, const QuadRect& rect)
+	{
+		uint32_t indexes = 0;
+		auto verticalMidpoint = bounds.x + (bounds.width / 2);
+		auto horizontalMidpoint = bounds.y + (bounds.height / 2);
+
+		// a zero sized rect lying on a midpoint still has to land somewhere
+		auto startIsNorth = rect.y < horizontalMidpoint;
+		auto startIsWest = rect.x < verticalMidpoint;
+		auto endIsEast = rect.x + rect.width > verticalMidpoint || rect.x >= verticalMidpoint;
+		auto endIsSouth = rect.y + rect.height > horizontalMidpoint || rect.y >= horizontalMidpoint;
+
+		//top-right quad
+		if (startIsNorth && endIsEast) {
+			indexes |= 1u << 0;
+		}
+
+		//top-left quad
+		if (startIsWest && startIsNorth) {
+			indexes |= 1u << 1;
+		}
+
+		//bottom-left quad
+		if (startIsWest && endIsSouth) {
+			indexes |= 1u << 2;
+		}
+
+		//bottom-right quad
+		if (endIsEast && endIsSouth) {
+			indexes |= 1u << 3;
+		}
+
+		return indexes;
+	}
+
+	// like getIndex, but a rect touching a midpoint counts for both sides
+	static uint32_t getOverlapIndex(const QuadRect& bounds, const QuadRect& rect)
+	{
+		auto verticalMidpoint = bounds.x + (bounds.width / 2);
+		auto horizontalMidpoint = bounds.y + (bounds.height / 2);
+
+		auto startIsNorth = rect.y <= horizontalMidpoint;
+		auto startIsWest = rect.x <= verticalMidpoint;
+		auto endIsEast = rect.x + rect.width >= verticalMidpoint;
+		auto endIsSouth = rect.y + rect.height >= horizontalMidpoint;
+
+		return (startIsNorth && endIsEast ? 1u << 0 : 0u) |
+			(startIsWest && startIsNorth ? 1u << 1 : 0u) |
+			(startIsWest && endIsSouth ? 1u << 2 : 0u) |
+			(endIsEast && endIsSouth ? 1u << 3 : 0u);
+	}
+
+private:
+	QuadRect m_bounds;
+	QuadtreePolicy m_policy;
+
+	std::vector<Node> m_nodes;
+	std::vector<ObjectData> m_elements;
+	std::vector<ElementNode> m_elementNodes;
+
+	// build() scratch, kept to reuse the storage across builds
+	std::vector<std::pair<uint32_t, int32_t>> m_buildOrder;
+	std::vector<std::pair<uint32_t, int32_t>> m_buildScratch;
+	std::vector<DeferredLink> m_buildDeferred;
+	// buildParallel() storage of the four subtrees below the root
+	std::vector<BuildArena> m_buildArenas;
+	// compact() scratch, the old index of every node in the new layout
+	std::vector<Node> m_compactNodes;
+	std::vector<ElementNode> m_compactElementNodes;
+	std::vector<int32_t> m_compactSource;
+	// bounds and element of the objects of every node, one array per side,
+	// filled by compact() and only used while m_packed is set
+	PackedFloats m_packedMinX;
+	PackedFloats m_packedMinY;
+	PackedFloats m_packedMaxX;
+	PackedFloats m_packedMaxY;
+	PackedElements m_packedElement;
+	// where every node's run starts in the packed arrays
+	std::vector<uint32_t> m_packedFirst;
+
+	// internal nodes that lost objects since the last cleanup
+	std::vector<int32_t> m_dirtyNodes;
+
+	// used by cleanup
+	QueryScratch m_scratch;
+
+	// number of objects not fully inside m_bounds, only non zero for bounds
+	// the root cannot grow around
+	uint32_t m_outsideCount;
+	uint32_t m_objectCount;
+
+	// first node of a free block of four, chained through Node::firstChild
+	int32_t m_freeNode;
+	int32_t m_freeElement;
+	int32_t m_freeElementNode;
+	// no modification since the last compact()
+	bool m_packed;
 };
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <limits>
+
+#include "Quadtree.h"
+
+// Hands finished trees from one writer thread to any number of reader threads
+// without locks. The writer builds a tree, publish() compacts it and swaps it
+// in with one atomic store, readers always see either the previous or the new
+// tree and never a tree under construction.
+//
+// Replaced trees are reclaimed epoch based: a reader announces the global
+// epoch in its slot before loading the tree pointer and clears the slot when
+// done. A tree retired at epoch r is only reused once every reader slot is
+// either idle or announces a later epoch, no reader can still hold it then.
+// Reclaimed trees become spares for the writer to build the next frame into,
+// so in steady state two or three trees take turns without allocating.
+//
+// publish, takeSpare and reclaim belong to the single writer thread, every
+// reader thread takes a slot with registerReader and queries with a
+// QueryScratch of its own. All readers have to be done before the snapshot is
+// destroyed.
+template<typename T, uint32_t MaxObjects = 10, uint32_t MaxLevels = 4>
+class QuadtreeSnapshot
+{
+public:
+
+	typedef Quadtree<T, MaxObjects, MaxLevels> Tree;
+
+	enum : uint32_t { MaxReaders = 64 };
+
+	// Keeps the published tree alive while it exists, only one per reader
+	// slot at a time.
+	class ReadLock
+	{
+	public:
+		ReadLock(ReadLock&& other)
+			: m_slot(other.m_slot)
+			, m_tree(other.m_tree)
+		{
+			other.m_slot = nullptr;
+			other.m_tree = nullptr;
+		}
+
+		~ReadLock()
+		{
+			if (m_slot)
+			{
+				m_slot->store(0);
+			}
+		}
+
+		// null until the first publish
+		const Tree* get() const
+		{
+			return m_tree;
+		}
+
+		const Tree* operator->() const
+		{
+			return m_tree;
+		}
+
+		const Tree& operator*() const
+		{
+			return *m_tree;
+		}
+
+		explicit operator bool() const
+		{
+			return m_tree != nullptr;
+		}
+
+	private:
+		friend class QuadtreeSnapshot;
+
+		ReadLock(std::atomic<uint64_t>* slot, const Tree* tree)
+			: m_slot(slot)
+			, m_tree(tree)
+		{
+		}
+
+		ReadLock(const ReadLock&) = delete;
+		ReadLock& operator=(const ReadLock&) = delete;
+
+		std::atomic<uint64_t>* m_slot;
+		const Tree* m_tree;
+	};
+
+	QuadtreeSnapshot()
+		: m_current(nullptr)
+		, m_epoch(1)
+	{
+		for (auto& slot : m_readerEpochs)
+		{
+			slot.store(0);
+		}
+		for (auto& used : m_readerUsed)
+		{
+			used.store(false);
+		}
+	}
+
+	// returns a slot for the calling reader thread, or -1 if all are taken
+	int32_t registerReader()
+	{
+		for (uint32_t reader = 0; reader < MaxReaders; ++reader)
+		{
+			auto expected = false;
+			if (m_readerUsed[reader].compare_exchange_strong(expected, true))
+			{
+				return static_cast<int32_t>(reader);
+			}
+		}
+		return -1;
+	}
+
+	void unregisterReader(int32_t reader)
+	{
+		m_readerEpochs[reader].store(0);
+		m_readerUsed[reader].store(false);
+	}
+
+	ReadLock read(int32_t reader) const
+	{
+		auto& slot = m_readerEpochs[reader];
+		// announce first, the writer then either sees the slot or has already
+		// swapped the pointer this load returns
+		slot.store(m_epoch.load());
+		return ReadLock(&slot, m_current.load());
+	}
+
+	// writer: a reclaimed tree to build the next snapshot into, null if none
+	std::unique_ptr<Tree> takeSpare()
+	{
+		reclaim();
+		if (m_spares.empty())
+		{
+			return nullptr;
+		}
+		auto tree = std::move(m_spares.back());
+		m_spares.pop_back();
+		return tree;
+	}
+
+	// writer: compacts tree and makes it the one readers see
+	void publish(std::unique_ptr<Tree> tree)
+	{
+		tree->compact();
+		m_current.store(tree.get());
+
+		if (m_published)
+		{
+			m_retired.push_back({ std::move(m_published), m_epoch.fetch_add(1) });
+		}
+		m_published = std::move(tree);
+		reclaim();
+	}
+
+	// writer: moves the retired trees no reader can see anymore to the spares
+	void reclaim()
+	{
+		if (m_retired.empty())
+		{
+			return;
+		}
+
+		auto oldest = std::numeric_limits<uint64_t>::max();
+		for (const auto& slot : m_readerEpochs)
+		{
+			auto epoch = slot.load();
+			if (epoch != 0 && epoch < oldest)
+			{
+				oldest = epoch;
+			}
+		}
+
+		auto kept = m_retired.begin();
+		for (auto it = m_retired.begin(); it != m_retired.end(); ++it)
+		{
+			if (it->epoch < oldest)
+			{
+				m_spares.push_back(std::move(it->tree));
+			}
+			else
+			{
+				*kept++ = std::move(*it);
+			}
+		}
+		m_retired.erase(kept, m_retired.end());
+	}
+
+	// writer: trees waiting for their readers to finish
+	size_t retiredCount() const
+	{
+		return m_retired.size();
+	}
+
+private:
+
+	struct Retired
+	{
+		std::unique_ptr<Tree> tree;
+		uint64_t epoch;
+	};
+
+	std::atomic<const Tree*> m_current;
+	std::atomic<uint64_t> m_epoch;
+	// epoch announced by each reader while it reads, 0 when idle
+	mutable std::atomic<uint64_t> m_readerEpochs[MaxReaders];
+	std::atomic<bool> m_readerUsed[MaxReaders];
+
+	// owned by the writer
+	std::unique_ptr<Tree> m_published;
+	std::vector<Retired> m_retired;
+	std::vector<std::unique_ptr<Tree>> m_spares;
+};
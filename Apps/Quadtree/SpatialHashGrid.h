@@ -0,0 +1,453 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+
+#include "imgui.h"
+
+#include "Quadtree.h"
+
+// Uniform grid without bounds: the plane is cut into square cells and only
+// the cells holding objects exist, found through an open addressing table
+// keyed by the cell coordinates. Every cell keeps its objects' bounds in one
+// dense array, so a query tests contiguous memory and only reads the payload
+// of hits. An object is linked into every cell it touches; a query spanning
+// several cells reports it from the first shared cell only.
+//
+// Suits scenes whose objects are all about one cell in size. Objects covering
+// more than LargeCells cells, or with non-finite bounds, are kept in a list
+// every query tests instead. Cells that become empty stay allocated for the
+// next object, clear() drops them.
+template<typename T>
+class SpatialHashGrid
+{
+public:
+
+	typedef int32_t Handle;
+
+	// the most cells an object is linked into
+	enum : uint32_t { LargeCells = 64 };
+
+	explicit SpatialHashGrid(float cellSize = 64.0f)
+		: m_cellSize(cellSize > 0.0f ? cellSize : 64.0f)
+		, m_inverseCellSize(1.0f / m_cellSize)
+		, m_freeElement(-1)
+		, m_usedCells(0)
+	{
+		m_table.resize(MinTableSize, { 0, 0, -1 });
+	}
+
+	Handle insert(const QuadRect& rect, const T& data)
+	{
+		int32_t element;
+		if (m_freeElement != -1)
+		{
+			element = m_freeElement;
+			m_freeElement = m_elements[element].next;
+			m_elements[element].bounds = rect;
+			m_elements[element].data = data;
+			m_elements[element].next = LiveElement;
+		}
+		else
+		{
+			element = static_cast<int32_t>(m_elements.size());
+			m_elements.push_back({ rect, data, CellRange(), LiveElement });
+		}
+		link(element, cellRange(rect));
+		return element;
+	}
+
+	void remove(Handle handle)
+	{
+		assert(isLive(handle));
+		unlink(handle);
+		auto& obj = m_elements[handle];
+		obj.data = T();
+		obj.next = m_freeElement;
+		m_freeElement = handle;
+	}
+
+	// Moves the object. Staying within the same cells only rewrites the
+	// bounds kept in them.
+	void update(Handle handle, const QuadRect& rect)
+	{
+		assert(isLive(handle));
+		auto& obj = m_elements[handle];
+		auto range = cellRange(rect);
+		obj.bounds = rect;
+		if (range == obj.range && !range.large)
+		{
+			forEachCell(range, [this, handle, &rect](int32_t x, int32_t y)
+			{
+				auto& entries = m_cells[findCell(x, y)].entries;
+				std::find_if(entries.begin(), entries.end(), [handle](const Entry& entry)
+				{
+					return entry.element == handle;
+				})->bounds = rect;
+			});
+			return;
+		}
+		unlink(handle);
+		link(handle, range);
+	}
+
+	const QuadRect& getBounds(Handle handle) const
+	{
+		return m_elements[handle].bounds;
+	}
+
+	float getCellSize() const
+	{
+		return m_cellSize;
+	}
+
+	void retrieve(const QuadRect& rect, std::vector<T>& returnObjects) const
+	{
+		retrieve(rect, [&returnObjects](const T& data)
+		{
+			returnObjects.push_back(data);
+		});
+	}
+
+	// Calls visitor(const T&) once for every object sharing a cell with the
+	// rect.
+	template<typename Visitor>
+	void retrieve(const QuadRect& rect, Visitor&& visitor) const
+	{
+		visitCells(rect, false, visitor);
+	}
+
+	// Calls visitor(const T&) once for every object whose bounds overlap
+	// rect, touching edges count as overlap.
+	template<typename Visitor>
+	void query(const QuadRect& rect, Visitor&& visitor) const
+	{
+		visitCells(rect, true, visitor);
+	}
+
+	void clear()
+	{
+		m_elements.clear();
+		m_freeElement = -1;
+		m_cells.clear();
+		m_large.clear();
+		m_usedCells = 0;
+		m_table.assign(MinTableSize, { 0, 0, -1 });
+	}
+
+	// a node per allocated cell, a leaf per non-empty one
+	QuadtreeStats getStats() const
+	{
+		QuadtreeStats stats = {};
+		stats.nodeCount = static_cast<uint32_t>(m_cells.size());
+		stats.linkCount = static_cast<uint32_t>(m_large.size());
+		for (const auto& cell : m_cells)
+		{
+			auto count = static_cast<uint32_t>(cell.entries.size());
+			stats.leafCount += count > 0 ? 1 : 0;
+			stats.maxLeafOccupancy = std::max(stats.maxLeafOccupancy, count);
+			stats.linkCount += count;
+		}
+		stats.objectCount = static_cast<uint32_t>(m_elements.size());
+		for (auto element = m_freeElement; element != -1; element = m_elements[element].next)
+		{
+			stats.objectCount--;
+		}
+		return stats;
+	}
+
+	// draws the non-empty cells
+	void debugDraw(ImDrawList* draw_list, ImVec2 canvas_pos) const
+	{
+		for (const auto& cell : m_cells)
+		{
+			if (cell.entries.empty())
+			{
+				continue;
+			}
+			auto x = cell.x * m_cellSize + canvas_pos.x;
+			auto y = cell.y * m_cellSize + canvas_pos.y;
+			draw_list->AddRect(ImVec2(x + 0.5f, y + 0.5f), ImVec2(x + m_cellSize - 0.5f, y + m_cellSize - 0.5f), IM_COL32(255, 160, 0, 255));
+		}
+	}
+
+private:
+
+	enum : uint32_t { MinTableSize = 64 };
+	// cell coordinates are clamped to this, far beyond any finite scene
+	enum : int32_t { CoordLimit = 1 << 28 };
+	enum : int32_t { LiveElement = -2 };
+
+	struct CellRange
+	{
+		CellRange()
+			: minX(0), minY(0), maxX(-1), maxY(-1), large(false)
+		{
+		}
+
+		int32_t minX;
+		int32_t minY;
+		int32_t maxX;
+		int32_t maxY;
+		// kept in m_large instead of the cells
+		bool large;
+
+		bool operator==(const CellRange& other) const
+		{
+			return minX == other.minX && minY == other.minY && maxX == other.maxX && maxY == other.maxY && large == other.large;
+		}
+	};
+
+	// an object's bounds as the cells keep them
+	struct Entry
+	{
+		QuadRect bounds;
+		int32_t element;
+	};
+
+	struct Cell
+	{
+		int32_t x;
+		int32_t y;
+		std::vector<Entry> entries;
+	};
+
+	// table slot, cell -1 while empty
+	struct Slot
+	{
+		int32_t x;
+		int32_t y;
+		int32_t cell;
+	};
+
+	struct Element
+	{
+		QuadRect bounds;
+		T data;
+		CellRange range;
+		// next free slot while the element is unused, LiveElement otherwise
+		int32_t next;
+	};
+
+	bool isLive(Handle handle) const
+	{
+		return handle >= 0 && static_cast<size_t>(handle) < m_elements.size() && m_elements[handle].next == LiveElement;
+	}
+
+	int32_t cellCoord(float value) const
+	{
+		auto coord = std::floor(value * m_inverseCellSize);
+		if (coord != coord)
+		{
+			return 0;
+		}
+		return static_cast<int32_t>(std::max(static_cast<float>(-CoordLimit), std::min(static_cast<float>(CoordLimit), coord)));
+	}
+
+	CellRange cellRange(const QuadRect& rect) const
+	{
+		CellRange range;
+		range.minX = cellCoord(rect.x);
+		range.minY = cellCoord(rect.y);
+		range.maxX = cellCoord(rect.x + rect.width);
+		range.maxY = cellCoord(rect.y + rect.height);
+		auto cells = (static_cast<int64_t>(range.maxX) - range.minX + 1) * (static_cast<int64_t>(range.maxY) - range.minY + 1);
+		range.large = !(std::isfinite(rect.x) && std::isfinite(rect.y) && std::isfinite(rect.width) && std::isfinite(rect.height)) ||
+			cells > LargeCells || cells <= 0;
+		return range;
+	}
+
+	template<typename Callback>
+	static void forEachCell(const CellRange& range, Callback&& callback)
+	{
+		for (auto y = range.minY; y <= range.maxY; ++y)
+		{
+			for (auto x = range.minX; x <= range.maxX; ++x)
+			{
+				callback(x, y);
+			}
+		}
+	}
+
+	size_t slotOf(int32_t x, int32_t y) const
+	{
+		auto key = (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+		return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (m_table.size() - 1);
+	}
+
+	// -1 if the cell was never allocated
+	int32_t findCell(int32_t x, int32_t y) const
+	{
+		for (auto slot = slotOf(x, y);; slot = (slot + 1) & (m_table.size() - 1))
+		{
+			const auto& entry = m_table[slot];
+			if (entry.cell == -1 || (entry.x == x && entry.y == y))
+			{
+				return entry.cell;
+			}
+		}
+	}
+
+	int32_t findOrAddCell(int32_t x, int32_t y)
+	{
+		auto cell = findCell(x, y);
+		if (cell != -1)
+		{
+			return cell;
+		}
+
+		// at most half full keeps the probe sequences short
+		if ((m_cells.size() + 1) * 2 > m_table.size())
+		{
+			m_table.assign(m_table.size() * 2, { 0, 0, -1 });
+			for (size_t index = 0; index < m_cells.size(); ++index)
+			{
+				placeCell(static_cast<int32_t>(index));
+			}
+		}
+		cell = static_cast<int32_t>(m_cells.size());
+		m_cells.push_back({ x, y, std::vector<Entry>() });
+		placeCell(cell);
+		return cell;
+	}
+
+	void placeCell(int32_t cell)
+	{
+		auto x = m_cells[cell].x;
+		auto y = m_cells[cell].y;
+		auto slot = slotOf(x, y);
+		while (m_table[slot].cell != -1)
+		{
+			slot = (slot + 1) & (m_table.size() - 1);
+		}
+		m_table[slot] = { x, y, cell };
+	}
+
+	void link(int32_t element, const CellRange& range)
+	{
+		auto& obj = m_elements[element];
+		obj.range = range;
+		if (range.large)
+		{
+			m_large.push_back(element);
+			return;
+		}
+		forEachCell(range, [this, element](int32_t x, int32_t y)
+		{
+			auto& cell = m_cells[findOrAddCell(x, y)];
+			if (cell.entries.empty())
+			{
+				m_usedCells++;
+			}
+			cell.entries.push_back({ m_elements[element].bounds, element });
+		});
+	}
+
+	void unlink(int32_t element)
+	{
+		const auto& range = m_elements[element].range;
+		if (range.large)
+		{
+			*std::find(m_large.begin(), m_large.end(), element) = m_large.back();
+			m_large.pop_back();
+			return;
+		}
+		forEachCell(range, [this, element](int32_t x, int32_t y)
+		{
+			auto& entries = m_cells[findCell(x, y)].entries;
+			*std::find_if(entries.begin(), entries.end(), [element](const Entry& entry)
+			{
+				return entry.element == element;
+			}) = entries.back();
+			entries.pop_back();
+			if (entries.empty())
+			{
+				m_usedCells--;
+			}
+		});
+	}
+
+	template<typename Visitor>
+	void visitCells(const QuadRect& rect, bool exact, Visitor& visitor) const
+	{
+		for (auto element : m_large)
+		{
+			const auto& obj = m_elements[element];
+			if (!exact || overlapsRect(obj.bounds, rect))
+			{
+				visitor(obj.data);
+			}
+		}
+
+		auto range = cellRange(rect);
+		auto cells = (static_cast<int64_t>(range.maxX) - range.minX + 1) * (static_cast<int64_t>(range.maxY) - range.minY + 1);
+		if (cells <= 0)
+		{
+			return;
+		}
+		if (static_cast<uint64_t>(cells) > m_usedCells)
+		{
+			// fewer non-empty cells than the rect covers, walk all cells instead
+			for (const auto& cell : m_cells)
+			{
+				if (cell.x >= range.minX && cell.x <= range.maxX && cell.y >= range.minY && cell.y <= range.maxY)
+				{
+					visitCell(cell, range, rect, exact, visitor);
+				}
+			}
+			return;
+		}
+		for (auto y = range.minY; y <= range.maxY; ++y)
+		{
+			for (auto x = range.minX; x <= range.maxX; ++x)
+			{
+				auto cell = findCell(x, y);
+				if (cell != -1)
+				{
+					visitCell(m_cells[cell], range, rect, exact, visitor);
+				}
+			}
+		}
+	}
+
+	template<typename Visitor>
+	void visitCell(const Cell& cell, const CellRange& range, const QuadRect& rect, bool exact, Visitor& visitor) const
+	{
+		for (const auto& entry : cell.entries)
+		{
+			if (exact && !overlapsRect(entry.bounds, rect))
+			{
+				continue;
+			}
+			// an object shared with the cells left of or above this one was
+			// reported there already
+			if ((cell.x != range.minX && cellCoord(entry.bounds.x) < cell.x) ||
+				(cell.y != range.minY && cellCoord(entry.bounds.y) < cell.y))
+			{
+				continue;
+			}
+			visitor(m_elements[entry.element].data);
+		}
+	}
+
+	static bool overlapsRect(const QuadRect& a, const QuadRect& b)
+	{
+		return !(a.x + a.width < b.x || b.x + b.width < a.x ||
+			a.y + a.height < b.y || b.y + b.height < a.y);
+	}
+
+private:
+	float m_cellSize;
+	float m_inverseCellSize;
+	std::vector<Element> m_elements;
+	int32_t m_freeElement;
+	std::vector<Cell> m_cells;
+	std::vector<Slot> m_table;
+	// objects every query tests
+	std::vector<int32_t> m_large;
+	// cells holding at least one object
+	size_t m_usedCells;
+};
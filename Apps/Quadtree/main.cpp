@@ -14,14 +14,80 @@
 #include <thread>
 #include <mutex>
 #include <set>
+#include <condition_variable>
+#include <new>
+#include <cstdlib>
 
 #include "texture/TextureCache.h"
+#include "job/JobSystem.h"
 
 #include "Quadtree.h"
+#include "LooseQuadtree.h"
+#include "QuadtreeSnapshot.h"
+#include "EntityPool.h"
+#include "LinearQuadtree.h"
+#include "SpatialHashGrid.h"
+#include "DynamicAABBTree.h"
 
 #include "windows.h"
 
 bool show_imgui_demo = false;
+bool show_benchmark = false;
+bool use_exact_query = true;
+// structure the test window queries and draws, all of them hold the rects
+enum Broadphase
+{
+	Broadphase_Quadtree,
+	Broadphase_LooseQuadtree,
+	Broadphase_SpatialHashGrid,
+	Broadphase_DynamicAABBTree,
+};
+int broadphase = Broadphase_Quadtree;
+bool use_snapshot_tree = false;
+bool use_line_of_sight = false;
+
+// Counts the heap allocations of every thread so the window can show how many
+// of them happen inside the quadtree query loop. Per thread, the snapshot
+// worker can build its tree while the main thread queries.
+static thread_local size_t g_allocationCount = 0;
+static size_t g_queryAllocations = 0;
+static size_t g_queryCount = 0;
+
+void* operator new(std::size_t size)
+{
+	g_allocationCount++;
+	if (void* ptr = std::malloc(size ? size : 1))
+	{
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+// the other forms go through the two above, whichever the compiler picks
+void* operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	::operator delete(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	::operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	::operator delete(ptr);
+}
 
 const char* Application_GetName()
 {
@@ -37,6 +103,12 @@ struct Rect : ImVec2
 	bool quadtree_intersects;
 	bool rect_intersects;
 	bool isUser;
+	// own handle in rects, the payload both trees store
+	EntityHandle entity;
+	int32_t handle;
+	int32_t looseHandle;
+	int32_t gridHandle;
+	int32_t bvhHandle;
 
 	float getMaxX() const
 	{
@@ -63,6 +135,11 @@ struct Rect : ImVec2
 		return !(getMaxX() < rect.getMinX() || rect.getMaxX() < getMinX() || getMaxY() < rect.getMinY() ||
 			rect.getMaxY() < getMinY());
 	}
+
+	QuadRect getQuadRect() const
+	{
+		return QuadRect(getMinX(), getMinY(), w, h);
+	}
 };
 
 inline float vec2Length(const ImVec2& pt)
@@ -70,12 +147,85 @@ inline float vec2Length(const ImVec2& pt)
 	return ::sqrt(pt.x * pt.x + pt.y * pt.y);
 }
 
-std::vector<std::shared_ptr<Rect>> rects;
-std::set<std::shared_ptr<Rect>> clickRects;
+EntityPool<Rect> rects;
+std::set<EntityHandle> clickRects;
 
 #define RANDOM_RECT_RANGE_W 400
 #define RANDOM_RECT_RANGE_H 300
 
+// kept across frames, rects that move are relocated with update() and the
+// root grows when one leaves it
+Quadtree<EntityHandle> qtree(QuadRect(-RANDOM_RECT_RANGE_W, -RANDOM_RECT_RANGE_H, RANDOM_RECT_RANGE_W * 2, RANDOM_RECT_RANGE_H * 2));
+// holds the same rects, the window switches between the two
+LooseQuadtree<EntityHandle> looseTree(QuadRect(-RANDOM_RECT_RANGE_W, -RANDOM_RECT_RANGE_H, RANDOM_RECT_RANGE_W * 2, RANDOM_RECT_RANGE_H * 2));
+// cells about the size of the largest rects
+int gridCellSize = 64;
+SpatialHashGrid<EntityHandle> grid(static_cast<float>(gridCellSize));
+// fat boxes a little larger than the fastest move of a frame
+DynamicAABBTree<EntityHandle> bvh(12.0f);
+
+void updateTrees(const Rect& rect)
+{
+	qtree.update(rect.handle, rect.getQuadRect());
+	looseTree.update(rect.looseHandle, rect.getQuadRect());
+	grid.update(rect.gridHandle, rect.getQuadRect());
+	bvh.update(rect.bvhHandle, rect.getQuadRect());
+}
+
+// The debug draw can show a tree a worker thread builds from the rects of the
+// previous frame, handed over through the snapshot without locking.
+QuadtreeSnapshot<int> snapshot;
+int32_t snapshotReader = -1;
+std::thread snapshotWorker;
+std::mutex snapshotMutex;
+std::condition_variable snapshotWake;
+std::vector<std::pair<QuadRect, int>> snapshotItems;
+bool snapshotPending = false;
+bool snapshotQuit = false;
+
+void snapshotWorkerLoop()
+{
+	std::vector<std::pair<QuadRect, int>> items;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(snapshotMutex);
+			snapshotWake.wait(lock, []()
+			{
+				return snapshotPending || snapshotQuit;
+			});
+			if (snapshotQuit)
+			{
+				return;
+			}
+			items.swap(snapshotItems);
+			snapshotPending = false;
+		}
+
+		auto tree = snapshot.takeSpare();
+		if (!tree)
+		{
+			tree.reset(new QuadtreeSnapshot<int>::Tree(QuadRect(-RANDOM_RECT_RANGE_W, -RANDOM_RECT_RANGE_H, RANDOM_RECT_RANGE_W * 2, RANDOM_RECT_RANGE_H * 2)));
+		}
+		tree->build(items);
+		snapshot.publish(std::move(tree));
+	}
+}
+
+void submitSnapshot()
+{
+	{
+		std::lock_guard<std::mutex> lock(snapshotMutex);
+		snapshotItems.clear();
+		for (const auto& rect : rects)
+		{
+			snapshotItems.push_back({ rect.getQuadRect(), static_cast<int>(snapshotItems.size()) });
+		}
+		snapshotPending = true;
+	}
+	snapshotWake.notify_one();
+}
+
 int random(int min, int max)
 {
 	return min + std::rand() % (max - min);
@@ -85,43 +235,231 @@ void Application_Initialize()
 {
 	for (auto i = 0; i < 100; ++i)
 	{
-		auto rect = std::make_shared<Rect>();
-		rect->x = random(-RANDOM_RECT_RANGE_W, RANDOM_RECT_RANGE_W + 100);
-		rect->y = random(-RANDOM_RECT_RANGE_H, RANDOM_RECT_RANGE_H + 100);
-		rect->w = random(20, 70);
-		rect->h = random(20, 70);
-		rect->quadtree_intersects = false;
-		rect->isUser = false;
+		Rect rect = {};
+		rect.x = random(-RANDOM_RECT_RANGE_W, RANDOM_RECT_RANGE_W + 100);
+		rect.y = random(-RANDOM_RECT_RANGE_H, RANDOM_RECT_RANGE_H + 100);
+		rect.w = random(20, 70);
+		rect.h = random(20, 70);
+		rect.quadtree_intersects = false;
+		rect.isUser = false;
 
-		rects.push_back(rect);
+		rects.create(rect);
 	}
 
 
 	for (auto i = 0; i < 1; ++i)
 	{
-		auto rect = std::make_shared<Rect>();
-		rect->x = random(-200, 200);
-		rect->y = random(-200, 200);
-		rect->w = random(10, 50);
-		rect->h = random(10, 50);
-		rect->quadtree_intersects = false;
-		rect->isUser = true;
-		rects.push_back(rect);
+		Rect rect = {};
+		rect.x = random(-200, 200);
+		rect.y = random(-200, 200);
+		rect.w = random(10, 50);
+		rect.h = random(10, 50);
+		rect.quadtree_intersects = false;
+		rect.isUser = true;
+		rects.create(rect);
+	}
+
+	for (size_t i = 0; i < rects.size(); ++i)
+	{
+		auto& rect = rects.begin()[i];
+		rect.entity = rects.handleAt(i);
+		rect.handle = qtree.insert(rect.getQuadRect(), rect.entity);
+		rect.looseHandle = looseTree.insert(rect.getQuadRect(), rect.entity);
+		rect.gridHandle = grid.insert(rect.getQuadRect(), rect.entity);
+		rect.bvhHandle = bvh.insert(rect.getQuadRect(), rect.entity);
 	}
+
+	snapshotReader = snapshot.registerReader();
+	snapshotWorker = std::thread(snapshotWorkerLoop);
 }
 
 void Application_Finalize()
 {
+	{
+		std::lock_guard<std::mutex> lock(snapshotMutex);
+		snapshotQuit = true;
+	}
+	snapshotWake.notify_one();
+	snapshotWorker.join();
+	snapshot.unregisterReader(snapshotReader);
+
+	qtree.clear();
+	looseTree.clear();
+	grid.clear();
+	bvh.clear();
+	rects.clear();
 	TextureCache::getInstance()->releaseAll();
 	TextureCache::destroy();
 }
 
 
 
+typedef std::chrono::high_resolution_clock BenchmarkClock;
+
+inline double elapsedMs(BenchmarkClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count();
+}
+
+// the trees and the grid share the query interface
+template<typename Tree>
+void queryTree(const Tree& tree)
+{
+	static std::vector<EntityHandle> objects;
+
+	for (auto& rect : rects)
+	{
+		if (rect.isUser)
+		{
+			g_queryCount++;
+			QuadRect queryRect = rect.getQuadRect();
+			if (use_exact_query)
+			{
+				// the tree already tested the bounds, every object is a hit
+				tree.query(queryRect, [&rect](EntityHandle handle)
+				{
+					auto& obj = rects[handle];
+					if (obj.isUser)
+					{
+						return;
+					}
+					obj.quadtree_intersects = true;
+					rect.rect_intersects = true;
+					obj.rect_intersects = true;
+				});
+				continue;
+			}
+
+			objects.clear();
+			tree.retrieve(queryRect, objects);
+			for (auto handle : objects)
+			{
+				auto& obj = rects[handle];
+				if (obj.isUser)
+				{
+					continue;
+				}
+				obj.quadtree_intersects = true;
+				if (rect.intersectsRect(obj))
+				{
+					rect.rect_intersects = true;
+					obj.rect_intersects = true;
+				}
+			}
+		}
+	}
+}
+
+// inserts every rect into an empty tree or grid
+template<typename Tree>
+double timeBuild(Tree&& tree)
+{
+	auto start = BenchmarkClock::now();
+	for (const auto& rect : rects)
+	{
+		tree.insert(rect.getQuadRect(), rect.entity);
+	}
+	return elapsedMs(start);
+}
+
 void drawTestWindow()
 {
 	ImGui::Begin("test");
 
+	static const char* broadphaseNames[] = { "quadtree", "loose quadtree", "spatial hash grid", "dynamic AABB tree" };
+	ImGui::PushItemWidth(160.0f);
+	ImGui::Combo("broadphase", &broadphase, broadphaseNames, IM_ARRAYSIZE(broadphaseNames));
+	ImGui::PopItemWidth();
+	ImGui::SameLine();
+	ImGui::Checkbox("exact query", &use_exact_query);
+	ImGui::SameLine();
+	ImGui::Checkbox("draw worker snapshot", &use_snapshot_tree);
+	ImGui::SameLine();
+	ImGui::Checkbox("line of sight", &use_line_of_sight);
+
+	if (broadphase == Broadphase_LooseQuadtree)
+	{
+		auto stats = looseTree.getStats();
+		ImGui::Text("cells: %u  max cell occupancy: %u  depth: %u  duplication: %.2f",
+			stats.leafCount, stats.maxLeafOccupancy, stats.maxDepth, stats.duplicationFactor());
+	}
+	else if (broadphase == Broadphase_SpatialHashGrid)
+	{
+		ImGui::PushItemWidth(120.0f);
+		if (ImGui::SliderInt("cell size", &gridCellSize, 8, 256))
+		{
+			grid = SpatialHashGrid<EntityHandle>(static_cast<float>(gridCellSize));
+			for (auto& rect : rects)
+			{
+				rect.gridHandle = grid.insert(rect.getQuadRect(), rect.entity);
+			}
+		}
+		ImGui::PopItemWidth();
+		ImGui::SameLine();
+		auto stats = grid.getStats();
+		ImGui::Text("cells: %u  used: %u  max cell occupancy: %u  duplication: %.2f",
+			stats.nodeCount, stats.leafCount, stats.maxLeafOccupancy, stats.duplicationFactor());
+	}
+	else if (broadphase == Broadphase_DynamicAABBTree)
+	{
+		auto stats = bvh.getStats();
+		ImGui::Text("leaves: %u  height: %u", stats.leafCount, stats.maxDepth);
+	}
+	else
+	{
+		auto policy = qtree.getPolicy();
+		int maxObjects = policy.maxObjects;
+		int maxLevels = policy.maxLevels;
+		bool changed = false;
+		ImGui::PushItemWidth(120.0f);
+		changed |= ImGui::SliderInt("leaf capacity", &maxObjects, 1, 64);
+		ImGui::SameLine();
+		changed |= ImGui::SliderInt("depth limit", &maxLevels, 1, 12);
+		ImGui::PopItemWidth();
+		ImGui::SameLine();
+		changed |= ImGui::Checkbox("adaptive", &policy.adaptive);
+		ImGui::SameLine();
+		changed |= ImGui::Checkbox("straddlers in parent", &policy.storeStraddlersInParent);
+		if (changed)
+		{
+			policy.maxObjects = maxObjects;
+			policy.maxLevels = maxLevels;
+			qtree.setPolicy(policy);
+		}
+
+		auto stats = qtree.getStats();
+		auto root = qtree.getRootBounds();
+		ImGui::Text("leaves: %u  max leaf occupancy: %u  depth: %u  duplication: %.2f  root: %.0fx%.0f",
+			stats.leafCount, stats.maxLeafOccupancy, stats.maxDepth, stats.duplicationFactor(), root.width, root.height);
+	}
+
+	// The query time is the one of the previous frame, smoothed over
+	// frames. Building a second structure from all rects costs as much as
+	// the rebuild the frame no longer does, so that is only timed on demand.
+	static double buildMs = 0.0;
+	static double queryMs = 0.0;
+	if (ImGui::Button("time build"))
+	{
+		if (broadphase == Broadphase_LooseQuadtree)
+		{
+			buildMs = timeBuild(LooseQuadtree<EntityHandle>(QuadRect(-RANDOM_RECT_RANGE_W, -RANDOM_RECT_RANGE_H, RANDOM_RECT_RANGE_W * 2, RANDOM_RECT_RANGE_H * 2)));
+		}
+		else if (broadphase == Broadphase_SpatialHashGrid)
+		{
+			buildMs = timeBuild(SpatialHashGrid<EntityHandle>(static_cast<float>(gridCellSize)));
+		}
+		else if (broadphase == Broadphase_DynamicAABBTree)
+		{
+			buildMs = timeBuild(DynamicAABBTree<EntityHandle>(12.0f));
+		}
+		else
+		{
+			buildMs = timeBuild(Quadtree<EntityHandle>(qtree.getRootBounds(), qtree.getPolicy()));
+		}
+	}
+	ImGui::SameLine();
+	ImGui::Text("build %d rects: %.3f ms  query: %.3f ms", static_cast<int>(rects.size()), buildMs, queryMs);
+
 	ImDrawList* draw_list = ImGui::GetWindowDrawList();
 
 	// Here we are using InvisibleButton() as a convenience to 1) advance the cursor and 2) allows us to use IsItemHovered()
@@ -150,69 +488,95 @@ void drawTestWindow()
 
 
 
-	Quadtree<std::shared_ptr<Rect>> qtree(QuadRect(-RANDOM_RECT_RANGE_W, -RANDOM_RECT_RANGE_H, RANDOM_RECT_RANGE_W * 2, RANDOM_RECT_RANGE_H * 2));
 	for (auto& rect : rects)
 	{
-		rect->quadtree_intersects = false;
-		rect->rect_intersects = false;
-		if (!rect->isUser)
-		{
-			qtree.insert(QuadRect(rect->x - rect->w * 0.5f, rect->y - rect->h * 0.5f, rect->w, rect->h), rect);
-		}
+		rect.quadtree_intersects = false;
+		rect.rect_intersects = false;
 	}
+	qtree.cleanup();
 
 
-	for (auto& rect : rects)
+	auto allocationsBeforeQuery = g_allocationCount;
+	g_queryCount = 0;
+
+	auto queryStart = BenchmarkClock::now();
+	if (broadphase == Broadphase_LooseQuadtree)
+	{
+		queryTree(looseTree);
+	}
+	else if (broadphase == Broadphase_SpatialHashGrid)
+	{
+		queryTree(grid);
+	}
+	else if (broadphase == Broadphase_DynamicAABBTree)
 	{
-		if (rect->isUser)
+		queryTree(bvh);
+	}
+	else
+	{
+		queryTree(qtree);
+	}
+	queryMs = queryMs * 0.9 + elapsedMs(queryStart) * 0.1;
+	g_queryAllocations = g_allocationCount - allocationsBeforeQuery;
+
+	if (use_snapshot_tree)
+	{
+		// shows the last tree the worker finished, one or two frames behind
+		submitSnapshot();
+		auto published = snapshot.read(snapshotReader);
+		if (published)
 		{
-			std::vector<std::shared_ptr<Rect>> objects;
-			qtree.retrieve(QuadRect(rect->x - rect->w * 0.5f, rect->y - rect->h * 0.5f, rect->w, rect->h), objects);
-			for (auto& obj : objects)
-			{
-				obj->quadtree_intersects = true;
-				if (rect->intersectsRect(*obj))
-				{
-					rect->rect_intersects = true;
-					obj->rect_intersects = true;
-				}
-			}
+			published->debugDraw(draw_list, canvas_pos + center);
 		}
 	}
-
-	qtree.debugDraw(draw_list, canvas_pos + center);
+	else if (broadphase == Broadphase_LooseQuadtree)
+	{
+		looseTree.debugDraw(draw_list, canvas_pos + center);
+	}
+	else if (broadphase == Broadphase_SpatialHashGrid)
+	{
+		grid.debugDraw(draw_list, canvas_pos + center);
+	}
+	else if (broadphase == Broadphase_DynamicAABBTree)
+	{
+		bvh.debugDraw(draw_list, canvas_pos + center);
+	}
+	else
+	{
+		qtree.debugDraw(draw_list, canvas_pos + center);
+	}
 
 	for (auto& rect : rects)
 	{
 		ImVec2 v[4];
-		v[0].x = center.x + canvas_pos.x + rect->x - rect->w * 0.5f;
-		v[0].y = center.y + canvas_pos.y + rect->y + rect->h * 0.5f;
+		v[0].x = center.x + canvas_pos.x + rect.x - rect.w * 0.5f;
+		v[0].y = center.y + canvas_pos.y + rect.y + rect.h * 0.5f;
 
-		v[1].x = center.x + canvas_pos.x + rect->x + rect->w * 0.5f;
-		v[1].y = center.y + canvas_pos.y + rect->y + rect->h * 0.5f;
+		v[1].x = center.x + canvas_pos.x + rect.x + rect.w * 0.5f;
+		v[1].y = center.y + canvas_pos.y + rect.y + rect.h * 0.5f;
 
-		v[2].x = center.x + canvas_pos.x + rect->x + rect->w * 0.5f;
-		v[2].y = center.y + canvas_pos.y + rect->y - rect->h * 0.5f;
+		v[2].x = center.x + canvas_pos.x + rect.x + rect.w * 0.5f;
+		v[2].y = center.y + canvas_pos.y + rect.y - rect.h * 0.5f;
 
-		v[3].x = center.x + canvas_pos.x + rect->x - rect->w * 0.5f;
-		v[3].y = center.y + canvas_pos.y + rect->y - rect->h * 0.5f;
+		v[3].x = center.x + canvas_pos.x + rect.x - rect.w * 0.5f;
+		v[3].y = center.y + canvas_pos.y + rect.y - rect.h * 0.5f;
 
-		if (rect->rect_intersects)
+		if (rect.rect_intersects)
 		{
-			if (rect->isUser)
+			if (rect.isUser)
 				draw_list->AddPolyline(v, 4, IM_COL32(0, 255, 0, 255), true, 0.0f);
 			else
 				draw_list->AddPolyline(v, 4, IM_COL32(255, 0, 0, 255), true, 0.0f);
 		}
 		else
 		{
-			if (rect->quadtree_intersects)
+			if (rect.quadtree_intersects)
 			{
 				draw_list->AddPolyline(v, 4, IM_COL32(255, 255, 255, 255), true, 0.0f);
 			}
 			else
 			{
-				if (rect->isUser)
+				if (rect.isUser)
 					draw_list->AddPolyline(v, 4, IM_COL32(0, 255, 0, 255), true, 0.0f);
 				else
 					draw_list->AddPolyline(v, 4, IM_COL32(200, 200, 0, 255), true, 0.0f);
@@ -220,6 +584,25 @@ void drawTestWindow()
 		}
 	}
 
+	if (use_line_of_sight)
+	{
+		// from the user rect to the mouse, stopped by the first other rect
+		for (auto& rect : rects)
+		{
+			if (!rect.isUser)
+			{
+				continue;
+			}
+			auto hit = qtree.segmentCast(rect.x, rect.y, mouse_pos_in_canvas.x, mouse_pos_in_canvas.y, [](EntityHandle handle, float)
+			{
+				return !rects[handle].isUser;
+			});
+			auto dir = mouse_pos_in_canvas - rect;
+			auto end = hit.hit ? rect + dir * (hit.distance / vec2Length(dir)) : mouse_pos_in_canvas;
+			draw_list->AddLine(canvas_pos + center + rect, canvas_pos + center + end, hit.hit ? IM_COL32(255, 0, 0, 255) : IM_COL32(0, 255, 0, 255));
+		}
+	}
+
 	if (!ImGui::IsMouseDown(0))
 	{
 		clickRects.clear();
@@ -229,16 +612,17 @@ void drawTestWindow()
 	{	
 		for (auto& rect : rects)
 		{
-			if (rect->isUser)
+			if (rect.isUser)
 			{
-				if (std::abs(mouse_pos_in_canvas.x - rect->x) <= rect->w * 0.5f &&
-					std::abs(mouse_pos_in_canvas.y - rect->y) <= rect->h * 0.5f)
+				if (std::abs(mouse_pos_in_canvas.x - rect.x) <= rect.w * 0.5f &&
+					std::abs(mouse_pos_in_canvas.y - rect.y) <= rect.h * 0.5f)
 				{
-					if (clickRects.count(rect) <= 0)
+					if (clickRects.count(rect.entity) <= 0)
 					{	
-						rect->x = ImGui::GetIO().MousePos.x - canvas_pos.x - center.x;
-						rect->y = ImGui::GetIO().MousePos.y - canvas_pos.y - center.y;
-						clickRects.insert(rect);
+						rect.x = ImGui::GetIO().MousePos.x - canvas_pos.x - center.x;
+						rect.y = ImGui::GetIO().MousePos.y - canvas_pos.y - center.y;
+						updateTrees(rect);
+						clickRects.insert(rect.entity);
 					}
 				}
 			}
@@ -250,9 +634,10 @@ void drawTestWindow()
 
 	const float MAX_SPEED = 10.0f;
 
-	for (auto& rect : clickRects)
+	for (auto handle : clickRects)
 	{
-		ImVec2 pt = mouse_pos_in_canvas  - *rect;
+		auto& rect = rects[handle];
+		ImVec2 pt = mouse_pos_in_canvas  - rect;
 		if (std::abs(vec2Length(pt) < 0.0001f))
 		{
 			continue;
@@ -274,8 +659,9 @@ void drawTestWindow()
 				addy = MAX_SPEED;
 		}
 
-		rect->x += addx;
-		rect->y += addy;
+		rect.x += addx;
+		rect.y += addy;
+		updateTrees(rect);
 	}
 
 	draw_list->PopClipRect();
@@ -283,16 +669,794 @@ void drawTestWindow()
 	ImGui::End();
 }
 
+// brute force counterpart of Quadtree::raycast, dir is normalized
+bool rayHitsRect(float x, float y, float dirX, float dirY, const QuadRect& rect, float maxDistance, float& distance)
+{
+	float enter = 0.0f;
+	float leave = maxDistance;
+	const float origin[2] = { x, y };
+	const float dir[2] = { dirX, dirY };
+	const float low[2] = { rect.x, rect.y };
+	const float high[2] = { rect.x + rect.width, rect.y + rect.height };
+	for (auto axis = 0; axis < 2; ++axis)
+	{
+		if (dir[axis] == 0.0f)
+		{
+			if (origin[axis] < low[axis] || origin[axis] > high[axis])
+				return false;
+			continue;
+		}
+		auto t0 = (low[axis] - origin[axis]) / dir[axis];
+		auto t1 = (high[axis] - origin[axis]) / dir[axis];
+		enter = std::max(enter, std::min(t0, t1));
+		leave = std::min(leave, std::max(t0, t1));
+	}
+	distance = enter;
+	return enter <= leave;
+}
+
+void drawBenchmarkWindow()
+{
+	ImGui::Begin("benchmark", &show_benchmark);
+
+	static double insertMs = 0.0;
+	static double buildMs = 0.0;
+	if (ImGui::Button("build 100k"))
+	{
+		const int range = 8000;
+		std::vector<std::pair<QuadRect, int>> items;
+		items.reserve(100000);
+		for (auto i = 0; i < 100000; ++i)
+		{
+			items.push_back({ QuadRect(random(-range, range), random(-range, range), random(20, 70), random(20, 70)), i });
+		}
+
+		Quadtree<int, 10, 8> tree(QuadRect(-range, -range, range * 2, range * 2));
+		auto start = BenchmarkClock::now();
+		for (const auto& item : items)
+		{
+			tree.insert(item.first, item.second);
+		}
+		insertMs = elapsedMs(start);
+
+		start = BenchmarkClock::now();
+		tree.build(items);
+		buildMs = elapsedMs(start);
+	}
+	ImGui::Text("insert loop: %.2f ms, build: %.2f ms", insertMs, buildMs);
+
+	static double queryLoopMs = 0.0;
+	static double queryBatchMs = 0.0;
+	// both have to report every overlap once
+	static size_t queryLoopHits = 0;
+	static size_t queryBatchHits = 0;
+	static int agentSpread = 2000;
+	ImGui::SliderInt("agent spread", &agentSpread, 200, 8000);
+	if (ImGui::Button("query 4096 agents"))
+	{
+		const int range = 8000;
+		std::vector<std::pair<QuadRect, int>> items;
+		items.reserve(100000);
+		for (auto i = 0; i < 100000; ++i)
+		{
+			items.push_back({ QuadRect(random(-range, range), random(-range, range), random(20, 70), random(20, 70)), i });
+		}
+		Quadtree<int, 10, 8> tree(QuadRect(-range, -range, range * 2, range * 2));
+		tree.build(items);
+
+		std::vector<QuadRect> agents;
+		for (auto i = 0; i < 4096; ++i)
+		{
+			agents.push_back(QuadRect(random(-agentSpread, agentSpread), random(-agentSpread, agentSpread), random(50, 300), random(50, 300)));
+		}
+
+		size_t loopHits = 0;
+		auto start = BenchmarkClock::now();
+		for (const auto& agent : agents)
+		{
+			tree.query(agent, [&loopHits](int)
+			{
+				loopHits++;
+			});
+		}
+		queryLoopMs = elapsedMs(start);
+		queryLoopHits = loopHits;
+
+		size_t batchHits = 0;
+		start = BenchmarkClock::now();
+		tree.queryBatch(agents, [&batchHits](size_t, int)
+		{
+			batchHits++;
+		});
+		queryBatchMs = elapsedMs(start);
+		queryBatchHits = batchHits;
+	}
+	ImGui::Text("query loop: %.2f ms, %d hits, queryBatch: %.2f ms, %d hits%s", queryLoopMs, (int)queryLoopHits,
+		queryBatchMs, (int)queryBatchHits, queryLoopHits != queryBatchHits ? ", MISMATCH" : "");
+
+	static double circleTreeMs = 0.0;
+	static double circleScanMs = 0.0;
+	static double nearestTreeMs = 0.0;
+	static double nearestScanMs = 0.0;
+	// shown so the compiler can't drop the scans
+	static size_t circleTreeHits = 0;
+	static size_t circleScanHits = 0;
+	static int64_t nearestTreeSum = 0;
+	static int64_t nearestScanSum = 0;
+	if (ImGui::Button("circle / 8 nearest, 2000 queries"))
+	{
+		const int range = 8000;
+		const float radius = 250.0f;
+		const uint32_t k = 8;
+		std::vector<std::pair<QuadRect, int>> items;
+		items.reserve(100000);
+		for (auto i = 0; i < 100000; ++i)
+		{
+			items.push_back({ QuadRect(random(-range, range), random(-range, range), random(20, 70), random(20, 70)), i });
+		}
+		Quadtree<int, 10, 8> tree(QuadRect(-range, -range, range * 2, range * 2));
+		tree.build(items);
+
+		std::vector<ImVec2> points;
+		for (auto i = 0; i < 2000; ++i)
+		{
+			points.push_back(ImVec2(random(-range, range), random(-range, range)));
+		}
+
+		circleTreeHits = 0;
+		auto start = BenchmarkClock::now();
+		for (const auto& point : points)
+		{
+			tree.queryCircle(point.x, point.y, radius, [](int)
+			{
+				circleTreeHits++;
+			});
+		}
+		circleTreeMs = elapsedMs(start);
+
+		circleScanHits = 0;
+		start = BenchmarkClock::now();
+		for (const auto& point : points)
+		{
+			for (const auto& item : items)
+			{
+				const auto& rect = item.first;
+				if (CircleToBox(point.x, point.y, radius, rect.x + rect.width * 0.5f, rect.y + rect.height * 0.5f, rect.width, rect.height))
+				{
+					circleScanHits++;
+				}
+			}
+		}
+		circleScanMs = elapsedMs(start);
+
+		nearestTreeSum = 0;
+		start = BenchmarkClock::now();
+		for (const auto& point : points)
+		{
+			tree.nearest(point.x, point.y, k, [](int data, float)
+			{
+				nearestTreeSum += data;
+			});
+		}
+		nearestTreeMs = elapsedMs(start);
+
+		nearestScanSum = 0;
+		std::vector<std::pair<float, int>> distances(items.size());
+		start = BenchmarkClock::now();
+		for (const auto& point : points)
+		{
+			for (size_t i = 0; i < items.size(); ++i)
+			{
+				const auto& rect = items[i].first;
+				distances[i] = { PointToBoxDistanceSq(point.x, point.y, rect.x + rect.width * 0.5f, rect.y + rect.height * 0.5f, rect.width, rect.height), items[i].second };
+			}
+			std::partial_sort(distances.begin(), distances.begin() + k, distances.end());
+			for (uint32_t i = 0; i < k; ++i)
+			{
+				nearestScanSum += distances[i].second;
+			}
+		}
+		nearestScanMs = elapsedMs(start);
+	}
+	ImGui::Text("queryCircle: %.2f ms, %d hits, scan: %.2f ms, %d hits", circleTreeMs, (int)circleTreeHits, circleScanMs, (int)circleScanHits);
+	ImGui::Text("nearest: %.2f ms, id sum %lld, scan + partial sort: %.2f ms, id sum %lld", nearestTreeMs, (long long)nearestTreeSum,
+		nearestScanMs, (long long)nearestScanSum);
+
+	static double raycastTreeMs = 0.0;
+	static double raycastSweepMs = 0.0;
+	// sums of the ids hit, -1 for a miss, the two should match
+	static int64_t raycastTreeSum = 0;
+	static int64_t raycastSweepSum = 0;
+	if (ImGui::Button("raycast 2000 rays"))
+	{
+		const int range = 8000;
+		std::vector<std::pair<QuadRect, int>> items;
+		items.reserve(100000);
+		for (auto i = 0; i < 100000; ++i)
+		{
+			items.push_back({ QuadRect(random(-range, range), random(-range, range), random(20, 70), random(20, 70)), i });
+		}
+		Quadtree<int, 10, 8> tree(QuadRect(-range, -range, range * 2, range * 2));
+		tree.build(items);
+
+		struct Ray
+		{
+			ImVec2 origin;
+			ImVec2 dir;
+		};
+		std::vector<Ray> rays;
+		for (auto i = 0; i < 2000; ++i)
+		{
+			auto angle = random(0, 3600) * 0.1f * 3.14159265f / 180.0f;
+			rays.push_back({ ImVec2(random(-range, range), random(-range, range)), ImVec2(cosf(angle), sinf(angle)) });
+		}
+
+		const float maxDistance = range * 4.0f;
+		raycastTreeSum = 0;
+		auto start = BenchmarkClock::now();
+		for (const auto& ray : rays)
+		{
+			auto hit = tree.raycast(ray.origin.x, ray.origin.y, ray.dir.x, ray.dir.y, maxDistance, [](int, float)
+			{
+				return true;
+			});
+			raycastTreeSum += hit.hit ? hit.data : -1;
+		}
+		raycastTreeMs = elapsedMs(start);
+
+		raycastSweepSum = 0;
+		start = BenchmarkClock::now();
+		for (const auto& ray : rays)
+		{
+			auto best = maxDistance;
+			auto bestItem = -1;
+			for (const auto& item : items)
+			{
+				float distance;
+				if (rayHitsRect(ray.origin.x, ray.origin.y, ray.dir.x, ray.dir.y, item.first, best, distance) && distance < best)
+				{
+					best = distance;
+					bestItem = item.second;
+				}
+			}
+			raycastSweepSum += bestItem;
+		}
+		raycastSweepMs = elapsedMs(start);
+	}
+	ImGui::Text("raycast: %.2f ms, id sum %lld, sweep: %.2f ms, id sum %lld", raycastTreeMs, (long long)raycastTreeSum,
+		raycastSweepMs, (long long)raycastSweepSum);
+
+	// same tree before and after compact(), which packs the leaf bounds
+	static double listQueryMs = 0.0;
+	static double packedQueryMs = 0.0;
+	// compact() must not change what query reports
+	static size_t listQueryHits = 0;
+	static size_t packedQueryHits = 0;
+	static int packedLeafCapacity = 128;
+	ImGui::SliderInt("leaf capacity##packed", &packedLeafCapacity, 8, 256);
+	if (ImGui::Button("query 20k, linked vs packed leaves"))
+	{
+		const int range = 8000;
+		std::vector<std::pair<QuadRect, int>> items;
+		items.reserve(200000);
+		for (auto i = 0; i < 200000; ++i)
+		{
+			items.push_back({ QuadRect(random(-range, range), random(-range, range), random(5, 20), random(5, 20)), i });
+		}
+		std::vector<QuadRect> queries;
+		for (auto i = 0; i < 20000; ++i)
+		{
+			queries.push_back(QuadRect(random(-range, range), random(-range, range), random(20, 120), random(20, 120)));
+		}
+
+		Quadtree<int, 10, 8> tree(QuadRect(-range, -range, range * 2, range * 2), QuadtreePolicy(packedLeafCapacity, 10));
+		tree.build(items);
+
+		size_t listHits = 0;
+		auto start = BenchmarkClock::now();
+		for (const auto& query : queries)
+		{
+			tree.query(query, [&listHits](int)
+			{
+				listHits++;
+			});
+		}
+		listQueryMs = elapsedMs(start);
+		listQueryHits = listHits;
+
+		tree.compact();
+		size_t packedHits = 0;
+		start = BenchmarkClock::now();
+		for (const auto& query : queries)
+		{
+			tree.query(query, [&packedHits](int)
+			{
+				packedHits++;
+			});
+		}
+		packedQueryMs = elapsedMs(start);
+		packedQueryHits = packedHits;
+	}
+	ImGui::Text("linked leaves: %.2f ms, %d hits, packed leaves: %.2f ms, %d hits%s", listQueryMs, (int)listQueryHits,
+		packedQueryMs, (int)packedQueryHits, listQueryHits != packedQueryHits ? ", MISMATCH" : "");
+
+	// static geometry in the linear tree, queried in memory and through a
+	// view over its serialized bytes as it would be from a mapped file
+	static double staticTreeMs = 0.0;
+	static double linearBuildMs = 0.0;
+	static double linearQueryMs = 0.0;
+	static double linearViewMs = 0.0;
+	static size_t linearBytes = 0;
+	// all three have to report the same overlaps
+	static size_t staticTreeHits = 0;
+	static size_t linearQueryHits = 0;
+	static size_t linearViewHits = 0;
+	if (ImGui::Button("static 200k, quadtree vs linear"))
+	{
+		const int range = 8000;
+		std::vector<std::pair<QuadRect, int>> items;
+		items.reserve(200000);
+		for (auto i = 0; i < 200000; ++i)
+		{
+			items.push_back({ QuadRect(random(-range, range), random(-range, range), random(5, 20), random(5, 20)), i });
+		}
+		std::vector<QuadRect> queries;
+		for (auto i = 0; i < 20000; ++i)
+		{
+			queries.push_back(QuadRect(random(-range, range), random(-range, range), random(20, 120), random(20, 120)));
+		}
+
+		Quadtree<int, 10, 8> tree(QuadRect(-range, -range, range * 2, range * 2), QuadtreePolicy(16, 10));
+		tree.build(items);
+		tree.compact();
+		size_t treeHits = 0;
+		auto start = BenchmarkClock::now();
+		for (const auto& query : queries)
+		{
+			tree.query(query, [&treeHits](int)
+			{
+				treeHits++;
+			});
+		}
+		staticTreeMs = elapsedMs(start);
+		staticTreeHits = treeHits;
+
+		LinearQuadtree<int> linear(QuadRect(-range, -range, range * 2, range * 2));
+		start = BenchmarkClock::now();
+		linear.build(items);
+		linearBuildMs = elapsedMs(start);
+
+		size_t linearHits = 0;
+		start = BenchmarkClock::now();
+		for (const auto& query : queries)
+		{
+			linear.query(query, [&linearHits](int)
+			{
+				linearHits++;
+			});
+		}
+		linearQueryMs = elapsedMs(start);
+		linearQueryHits = linearHits;
+
+		std::vector<uint8_t> bytes;
+		linear.serialize(bytes);
+		linearBytes = bytes.size();
+		LinearQuadtreeView<int> view;
+		size_t viewHits = 0;
+		if (LinearQuadtreeView<int>::fromBytes(bytes.data(), bytes.size(), view))
+		{
+			start = BenchmarkClock::now();
+			for (const auto& query : queries)
+			{
+				view.query(query, [&viewHits](int)
+				{
+					viewHits++;
+				});
+			}
+			linearViewMs = elapsedMs(start);
+		}
+		linearViewHits = viewHits;
+	}
+	ImGui::Text("quadtree: %.2f ms, %d hits, linear: build %.2f ms, query %.2f ms, %d hits%s", staticTreeMs, (int)staticTreeHits,
+		linearBuildMs, linearQueryMs, (int)linearQueryHits, staticTreeHits != linearQueryHits ? ", MISMATCH" : "");
+	ImGui::Text("view over %zu bytes: %.2f ms, %d hits%s", linearBytes, linearViewMs, (int)linearViewHits,
+		staticTreeHits != linearViewHits ? ", MISMATCH" : "");
+
+	// every frame all objects move, then each structure is brought up to date
+	// and asked for the overlapping pairs, the trees and the grid by one query
+	// per object, the AABB tree by testing itself against itself
+	struct MovingResult
+	{
+		const char* name;
+		double updateMs;
+		double pairsMs;
+	};
+	static std::vector<MovingResult> moving;
+	if (ImGui::Button("moving 20k, 30 frames"))
+	{
+		const int range = 4000;
+		const int count = 20000;
+		const int frames = 30;
+		std::vector<std::pair<QuadRect, int>> start;
+		std::vector<ImVec2> velocities;
+		for (auto i = 0; i < count; ++i)
+		{
+			start.push_back({ QuadRect(random(-range, range), random(-range, range), random(20, 70), random(20, 70)), i });
+			velocities.push_back(ImVec2(random(-10, 11) * 0.5f, random(-10, 11) * 0.5f));
+		}
+		auto items = start;
+		auto speeds = velocities;
+		auto restart = [&]()
+		{
+			items = start;
+			speeds = velocities;
+		};
+		auto step = [&]()
+		{
+			for (auto i = 0; i < count; ++i)
+			{
+				auto& rect = items[i].first;
+				rect.x += speeds[i].x;
+				rect.y += speeds[i].y;
+				if (rect.x < -range || rect.x > range)
+					speeds[i].x = -speeds[i].x;
+				if (rect.y < -range || rect.y > range)
+					speeds[i].y = -speeds[i].y;
+			}
+		};
+
+		moving.clear();
+		size_t pairs = 0;
+		auto countPairs = [&pairs](int i)
+		{
+			return [i, &pairs](int other)
+			{
+				if (other > i)
+					pairs++;
+			};
+		};
+		const QuadRect bounds(-range - 100, -range - 100, range * 2 + 200, range * 2 + 200);
+		{
+			Quadtree<int, 10, 8> tree(bounds);
+			std::vector<int32_t> handles;
+			for (const auto& item : items)
+			{
+				handles.push_back(tree.insert(item.first, item.second));
+			}
+			MovingResult result = { "quadtree, update", 0.0, 0.0 };
+			for (auto frame = 0; frame < frames; ++frame)
+			{
+				step();
+				auto begin = BenchmarkClock::now();
+				for (auto i = 0; i < count; ++i)
+				{
+					tree.update(handles[i], items[i].first);
+				}
+				tree.cleanup();
+				result.updateMs += elapsedMs(begin);
+				begin = BenchmarkClock::now();
+				for (auto i = 0; i < count; ++i)
+				{
+					tree.query(items[i].first, countPairs(i));
+				}
+				result.pairsMs += elapsedMs(begin);
+			}
+			moving.push_back(result);
+		}
+		restart();
+		{
+			Quadtree<int, 10, 8> tree(bounds);
+			MovingResult result = { "quadtree, build", 0.0, 0.0 };
+			for (auto frame = 0; frame < frames; ++frame)
+			{
+				step();
+				auto begin = BenchmarkClock::now();
+				tree.build(items);
+				result.updateMs += elapsedMs(begin);
+				begin = BenchmarkClock::now();
+				for (auto i = 0; i < count; ++i)
+				{
+					tree.query(items[i].first, countPairs(i));
+				}
+				result.pairsMs += elapsedMs(begin);
+			}
+			moving.push_back(result);
+		}
+		restart();
+		{
+			SpatialHashGrid<int> hashGrid(64.0f);
+			std::vector<int32_t> handles;
+			for (const auto& item : items)
+			{
+				handles.push_back(hashGrid.insert(item.first, item.second));
+			}
+			MovingResult result = { "spatial hash grid", 0.0, 0.0 };
+			for (auto frame = 0; frame < frames; ++frame)
+			{
+				step();
+				auto begin = BenchmarkClock::now();
+				for (auto i = 0; i < count; ++i)
+				{
+					hashGrid.update(handles[i], items[i].first);
+				}
+				result.updateMs += elapsedMs(begin);
+				begin = BenchmarkClock::now();
+				for (auto i = 0; i < count; ++i)
+				{
+					hashGrid.query(items[i].first, countPairs(i));
+				}
+				result.pairsMs += elapsedMs(begin);
+			}
+			moving.push_back(result);
+		}
+		restart();
+		{
+			DynamicAABBTree<int> tree(8.0f);
+			std::vector<int32_t> handles;
+			for (const auto& item : items)
+			{
+				handles.push_back(tree.insert(item.first, item.second));
+			}
+			MovingResult result = { "dynamic AABB tree", 0.0, 0.0 };
+			for (auto frame = 0; frame < frames; ++frame)
+			{
+				step();
+				auto begin = BenchmarkClock::now();
+				for (auto i = 0; i < count; ++i)
+				{
+					tree.update(handles[i], items[i].first);
+				}
+				result.updateMs += elapsedMs(begin);
+				begin = BenchmarkClock::now();
+				tree.queryPairs([&pairs](int, int)
+				{
+					pairs++;
+				});
+				result.pairsMs += elapsedMs(begin);
+			}
+			moving.push_back(result);
+		}
+		for (auto& result : moving)
+		{
+			result.updateMs /= frames;
+			result.pairsMs /= frames;
+		}
+	}
+	for (const auto& result : moving)
+	{
+		ImGui::Text("%s: update %.2f ms, pairs %.2f ms per frame", result.name, result.updateMs, result.pairsMs);
+	}
+
+	// build: the four root quadrants on up to four threads, query: every
+	// thread runs its share of the queries on the shared tree with its own scratch
+	struct ScalingResult
+	{
+		uint32_t threads;
+		double buildMs;
+		double queryMs;
+		// summed over the workers, the same for every thread count
+		size_t hits;
+	};
+	static std::vector<ScalingResult> scaling;
+	if (ImGui::Button("thread scaling"))
+	{
+		const int range = 8000;
+		std::vector<std::pair<QuadRect, int>> items;
+		items.reserve(200000);
+		for (auto i = 0; i < 200000; ++i)
+		{
+			items.push_back({ QuadRect(random(-range, range), random(-range, range), random(20, 70), random(20, 70)), i });
+		}
+		std::vector<QuadRect> queries;
+		for (auto i = 0; i < 40000; ++i)
+		{
+			queries.push_back(QuadRect(random(-range, range), random(-range, range), random(50, 300), random(50, 300)));
+		}
+
+		Quadtree<int, 10, 8> tree(QuadRect(-range, -range, range * 2, range * 2));
+		scaling.clear();
+		auto maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (uint32_t threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			ScalingResult result = { threads, 0.0, 0.0, 0 };
+			auto start = BenchmarkClock::now();
+			tree.buildParallel(items, threads);
+			result.buildMs = elapsedMs(start);
+
+			std::vector<std::thread> workers;
+			// written once per worker when it is done
+			std::vector<size_t> workerHits(threads, 0);
+			start = BenchmarkClock::now();
+			for (uint32_t worker = 0; worker < threads; ++worker)
+			{
+				workers.emplace_back([&tree, &queries, &workerHits, worker, threads]()
+				{
+					Quadtree<int, 10, 8>::QueryScratch scratch;
+					size_t hits = 0;
+					for (auto i = worker; i < queries.size(); i += threads)
+					{
+						tree.query(queries[i], [&hits](int)
+						{
+							hits++;
+						}, scratch);
+					}
+					workerHits[worker] = hits;
+				});
+			}
+			for (auto& worker : workers)
+			{
+				worker.join();
+			}
+			result.queryMs = elapsedMs(start);
+			for (auto hits : workerHits)
+			{
+				result.hits += hits;
+			}
+			scaling.push_back(result);
+		}
+	}
+	for (const auto& result : scaling)
+	{
+		ImGui::Text("%u threads: build 200k %.2f ms, 40k queries %.2f ms, %d hits%s", result.threads, result.buildMs, result.queryMs,
+			(int)result.hits, result.hits != scaling.front().hits ? ", MISMATCH" : "");
+	}
+
+	// the candidate pairs of retrieve get their exact test on the job system,
+	// in cache sized chunks with a hit list per thread
+	struct NarrowPhaseResult
+	{
+		uint32_t threads;
+		double testMs;
+		double mergeMs;
+		size_t steals;
+		bool same;
+	};
+	static std::vector<NarrowPhaseResult> narrowPhase;
+	static size_t narrowPairs = 0;
+	static size_t narrowHits = 0;
+	static double narrowSerialMs = 0.0;
+	if (ImGui::Button("narrow phase, 40k circles on 200k rects"))
+	{
+		struct QueryCircle
+		{
+			float x;
+			float y;
+			float radius;
+		};
+		struct CandidatePair
+		{
+			uint32_t circle;
+			int rect;
+		};
+
+		const int range = 8000;
+		Quadtree<int, 10, 8> tree(QuadRect(-range, -range, range * 2, range * 2));
+		std::vector<QuadRect> boxes;
+		boxes.reserve(200000);
+		for (auto i = 0; i < 200000; ++i)
+		{
+			boxes.push_back(QuadRect(random(-range, range), random(-range, range), random(20, 70), random(20, 70)));
+			tree.insert(boxes.back(), i);
+		}
+		std::vector<QueryCircle> circles;
+		for (auto i = 0; i < 40000; ++i)
+		{
+			circles.push_back({ static_cast<float>(random(-range, range)), static_cast<float>(random(-range, range)), static_cast<float>(random(20, 150)) });
+		}
+
+		std::vector<CandidatePair> pairs;
+		std::vector<int> objects;
+		for (uint32_t i = 0; i < circles.size(); ++i)
+		{
+			const auto& circle = circles[i];
+			objects.clear();
+			tree.retrieve(QuadRect(circle.x - circle.radius, circle.y - circle.radius, circle.radius * 2.0f, circle.radius * 2.0f), objects);
+			for (auto object : objects)
+			{
+				pairs.push_back({ i, object });
+			}
+		}
+		narrowPairs = pairs.size();
+
+		auto touches = [&circles, &boxes](const CandidatePair& pair)
+		{
+			const auto& circle = circles[pair.circle];
+			const auto& box = boxes[pair.rect];
+			return CircleToBox(circle.x, circle.y, circle.radius, box.x + box.width * 0.5f, box.y + box.height * 0.5f, box.width, box.height);
+		};
+
+		std::vector<CandidatePair> serialHits;
+		auto start = BenchmarkClock::now();
+		for (const auto& pair : pairs)
+		{
+			if (touches(pair))
+			{
+				serialHits.push_back(pair);
+			}
+		}
+		narrowSerialMs = elapsedMs(start);
+		narrowHits = serialHits.size();
+
+		narrowPhase.clear();
+		auto maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (uint32_t threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			JobSystem jobs(threads);
+			ThreadBuffers<std::vector<CandidatePair>> buffers(jobs.getThreadCount());
+			NarrowPhaseResult result = { threads, 0.0, 0.0, 0, false };
+			start = BenchmarkClock::now();
+			jobs.parallelFor(pairs.size(), JobSystem::chunkSizeFor(sizeof(CandidatePair)), [&](size_t begin, size_t end, uint32_t thread)
+			{
+				auto& hits = buffers[thread];
+				for (auto i = begin; i < end; ++i)
+				{
+					if (touches(pairs[i]))
+					{
+						hits.push_back(pairs[i]);
+					}
+				}
+			});
+			result.testMs = elapsedMs(start);
+
+			// every thread's hits get their own range of the output
+			start = BenchmarkClock::now();
+			std::vector<size_t> offsets(buffers.size() + 1, 0);
+			for (uint32_t thread = 0; thread < buffers.size(); ++thread)
+			{
+				offsets[thread + 1] = offsets[thread] + buffers[thread].size();
+			}
+			std::vector<CandidatePair> merged(offsets.back());
+			jobs.parallelFor(buffers.size(), 1, [&](size_t begin, size_t end, uint32_t)
+			{
+				for (auto thread = begin; thread < end; ++thread)
+				{
+					const auto& hits = buffers[static_cast<uint32_t>(thread)];
+					std::copy(hits.begin(), hits.end(), merged.begin() + offsets[thread]);
+				}
+			});
+			result.mergeMs = elapsedMs(start);
+			result.steals = jobs.getStealCount();
+
+			// chunks finish in any order, the hits are the same set
+			auto byPair = [](const CandidatePair& a, const CandidatePair& b)
+			{
+				return a.circle < b.circle || (a.circle == b.circle && a.rect < b.rect);
+			};
+			std::sort(merged.begin(), merged.end(), byPair);
+			auto expected = serialHits;
+			std::sort(expected.begin(), expected.end(), byPair);
+			result.same = std::equal(merged.begin(), merged.end(), expected.begin(), expected.end(), [](const CandidatePair& a, const CandidatePair& b)
+			{
+				return a.circle == b.circle && a.rect == b.rect;
+			});
+			narrowPhase.push_back(result);
+		}
+	}
+	if (narrowPairs > 0)
+	{
+		ImGui::Text("%zu pairs, %zu hits, serial %.2f ms", narrowPairs, narrowHits, narrowSerialMs);
+	}
+	for (const auto& result : narrowPhase)
+	{
+		ImGui::Text("%u threads: test %.2f ms, merge %.2f ms, %zu steals%s", result.threads, result.testMs, result.mergeMs, result.steals,
+			result.same ? "" : ", MISMATCH");
+	}
+
+	ImGui::End();
+}
+
 void Application_Frame()
 {
 	auto& io = ImGui::GetIO();
 	ImGui::NewLine();
 	ImGui::Text("FPS: %.2f (%.2gms)", io.Framerate, io.Framerate ? 1000.0f / io.Framerate : 0.0f);
+	ImGui::Text("Query allocations: %d (%d queries)", (int)g_queryAllocations, (int)g_queryCount);
 	if (ImGui::BeginMainMenuBar())
 	{
 		if (ImGui::BeginMenu("Tool"))
 		{
 			ImGui::MenuItem("imgui demo", "", &show_imgui_demo);
+			ImGui::MenuItem("benchmark", "", &show_benchmark);
 			ImGui::EndMenu();
 		}
 		ImGui::EndMainMenuBar();
@@ -303,6 +1467,11 @@ void Application_Frame()
 		ImGui::ShowDemoWindow(NULL);
 	}
 
+	if (show_benchmark)
+	{
+		drawBenchmarkWindow();
+	}
+
 	drawTestWindow();
 }
 